@@ -0,0 +1,226 @@
+// Measures how long it takes to fill in the user list of a large group chat and how much heap it
+// takes, with members added as temporary buddies and as chat users only. libpurple runs headless
+// with a stand-in protocol plugin and a connection that never goes online, so no requests are
+// made. Members have no picture, so icon downloads aren't part of the figures.
+//
+// Usage: chat_bench members lazy|full
+//
+// Lazy mode skips buddies for any number of members, whatever the account option says. Each mode
+// is run in its own process so that the heap starts out the same.
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <account.h>
+#include <blist.h>
+#include <connection.h>
+#include <conversation.h>
+#include <core.h>
+#include <debug.h>
+#include <eventloop.h>
+#include <plugin.h>
+#include <prpl.h>
+#include <server.h>
+#include <util.h>
+#include <version.h>
+
+#include "constants.hpp"
+#include "purpleline.hpp"
+
+static const char *BENCH_PRPL_ID = "prpl-line-bench";
+
+static std::mt19937 rng(3);
+
+static PurpleEventLoopUiOps eventloop_ops = {
+    g_timeout_add,
+    g_source_remove,
+    NULL,
+    NULL,
+    NULL,
+    g_timeout_add_seconds,
+    NULL,
+    NULL,
+    NULL,
+};
+
+static PurplePluginProtocolInfo prpl_info;
+static PurplePluginInfo info;
+
+static size_t heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return (size_t)mallinfo().uordblks;
+#endif
+}
+
+static std::string random_mid(char type) {
+    std::string s(1, type);
+
+    for (int i = 0; i < 32; i++)
+        s += "0123456789abcdef"[rng() % 16];
+
+    return s;
+}
+
+static std::string random_text(int min, int max) {
+    int n = min + rng() % (max - min + 1);
+    std::string s;
+
+    for (int i = 0; i < n; i++)
+        s += (char)('a' + rng() % 26);
+
+    return s;
+}
+
+static void register_prpl() {
+    prpl_info.list_icon = &PurpleLine::list_icon;
+    prpl_info.status_types = &PurpleLine::status_types;
+    prpl_info.struct_size = sizeof(PurplePluginProtocolInfo);
+
+    info.magic = PURPLE_PLUGIN_MAGIC;
+    info.major_version = PURPLE_MAJOR_VERSION;
+    info.minor_version = PURPLE_MINOR_VERSION;
+    info.type = PURPLE_PLUGIN_PROTOCOL;
+    info.priority = PURPLE_PRIORITY_DEFAULT;
+    info.id = (char *)BENCH_PRPL_ID;
+    info.name = (char *)"LINE benchmark";
+    info.extra_info = &prpl_info;
+
+    PurplePlugin *plugin = purple_plugin_new(TRUE, NULL);
+    plugin->info = &info;
+
+    purple_plugin_register(plugin);
+    purple_plugin_load(plugin);
+}
+
+struct ChatBench {
+
+    static int run(int n_members, bool lazy) {
+        PurpleAccount *acct = purple_account_new("bench", BENCH_PRPL_ID);
+        purple_accounts_add(acct);
+
+        purple_account_set_int(acct, LINE_ACCOUNT_LAZY_MEMBERS_THRESHOLD, lazy ? 1 : 0);
+
+        PurpleConnection *conn = g_new0(PurpleConnection, 1);
+        conn->prpl = purple_find_prpl(BENCH_PRPL_ID);
+        conn->account = acct;
+        conn->state = PURPLE_CONNECTED;
+        purple_account_set_connection(acct, conn);
+
+        PurpleLine *line = new PurpleLine(conn, acct);
+        purple_connection_set_protocol_data(conn, line);
+
+        line->profile.mid = random_mid('u');
+
+        line::Group group;
+        group.id = random_mid('c');
+        group.name = random_text(5, 30);
+
+        for (int i = 0; i < n_members; i++) {
+            line::Contact c;
+            c.mid = random_mid('u');
+            c.displayName = random_text(4, 20);
+            c.statusMessage = (rng() % 2) ? random_text(5, 60) : "";
+            c.attributes = 0;
+
+            line->store.update_contact(c);
+            group.members.push_back(c);
+        }
+
+        group.creator = group.members[0];
+
+        const GroupInfo &group_info = line->store.update_group(group);
+
+        // Created before the signals are connected, so that no history is requested
+        PurpleConversation *conv = serv_got_joined_chat(conn, 1, group.id.c_str());
+        line->connect_signals();
+
+        size_t heap_before = heap_in_use();
+        gint64 start = g_get_monotonic_time();
+
+        line->set_chat_participants(PURPLE_CONV_CHAT(conv), group_info);
+
+        gint64 elapsed = g_get_monotonic_time() - start;
+        size_t heap_after = heap_in_use();
+
+        int named = 0;
+
+        for (GList *l = purple_conv_chat_get_users(PURPLE_CONV_CHAT(conv)); l; l = l->next) {
+            PurpleConvChatBuddy *cb = (PurpleConvChatBuddy *)l->data;
+
+            if (!purple_strequal(cb->alias, cb->name))
+                named++;
+        }
+
+        GSList *buddies = purple_find_buddies(acct, NULL);
+
+        printf("%d members, %s: %.1f ms, %.1f MiB heap, %d buddies, %d users with a name\n",
+            n_members, lazy ? "lazy" : "full", elapsed / 1000.0,
+            (double)(heap_after - heap_before) / (1024 * 1024), (int)g_slist_length(buddies),
+            named);
+
+        g_slist_free(buddies);
+
+        if (named != n_members) {
+            fprintf(stderr, "Some chat users are shown by their MID\n");
+            return 1;
+        }
+
+        return 0;
+    }
+
+};
+
+int main(int argc, char **argv) {
+    if (argc != 3 || (strcmp(argv[2], "lazy") != 0 && strcmp(argv[2], "full") != 0)) {
+        fprintf(stderr, "Usage: %s members lazy|full\n", argv[0]);
+        return 1;
+    }
+
+    int n_members = atoi(argv[1]);
+    if (n_members < 1) {
+        fprintf(stderr, "Need at least one member\n");
+        return 1;
+    }
+
+    // Count GSlice allocations in the heap figures too
+    g_setenv("G_SLICE", "always-malloc", TRUE);
+
+    gchar *user_dir = g_dir_make_tmp("line-bench-XXXXXX", NULL);
+    if (!user_dir) {
+        fprintf(stderr, "Couldn't create a temporary directory\n");
+        return 1;
+    }
+
+    purple_util_set_user_dir(user_dir);
+    purple_debug_set_enabled(FALSE);
+    purple_eventloop_set_ui_ops(&eventloop_ops);
+
+    if (!purple_core_init("line-bench")) {
+        fprintf(stderr, "Couldn't initialize libpurple\n");
+        return 1;
+    }
+
+    purple_set_blist(purple_blist_new());
+    purple_blist_load();
+
+    register_prpl();
+
+    int result = ChatBench::run(n_members, strcmp(argv[2], "lazy") == 0);
+
+    // libpurple isn't shut down, and it saves its files from timeouts that never run, so the
+    // directory should still be empty
+    g_rmdir(user_dir);
+    g_free(user_dir);
+
+    return result;
+}
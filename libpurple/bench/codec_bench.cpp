@@ -0,0 +1,469 @@
+// Checks the generated compact protocol codecs against the Thrift library, and compares how fast
+// they decode a fetchOperations reply. LINE types are encoded with TCompactProtocol and decoded
+// with the codec, and the other way around, covering maps, lists, nested structs, optional fields,
+// bool fields and field IDs that are more than 15 apart or go backwards.
+//
+// Usage: codec_bench [libline.so]
+//
+// If the plugin is given, its size and the time it takes to load are also shown. Loading includes
+// libpurple and the other libraries the plugin links to, unless they're already loaded.
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include "thrift_line/TalkService.h"
+#include "thrift_line/line_codec.hpp"
+
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::protocol::TMessageType;
+using apache::thrift::transport::TMemoryBuffer;
+
+using line_codec::Codec;
+
+// Operations in the fetchOperations reply used for timing, and how many times it's decoded
+static const int N_OPERATIONS = 100;
+static const int ROUNDS = 2000;
+
+static std::mt19937 rng(7);
+
+static volatile size_t sink;
+
+static std::string random_mid(char type) {
+    std::string s(1, type);
+
+    for (int i = 0; i < 32; i++)
+        s += "0123456789abcdef"[rng() % 16];
+
+    return s;
+}
+
+static std::string random_text(int min, int max) {
+    int n = min + rng() % (max - min + 1);
+    std::string s;
+
+    for (int i = 0; i < n; i++)
+        s += (char)('a' + rng() % 26);
+
+    return s;
+}
+
+static std::string random_bytes(int n) {
+    std::string s;
+
+    for (int i = 0; i < n; i++)
+        s += (char)(rng() % 256);
+
+    return s;
+}
+
+static line::Contact make_contact() {
+    line::Contact c;
+
+    c.mid = random_mid('u');
+    c.status = line::ContactStatus::FRIEND;
+    c.displayName = random_text(4, 20);
+    c.statusMessage = random_text(0, 60);
+    c.attributes = (int32_t)(rng() % 64) - 32;
+    c.picturePath = "/" + random_text(40, 60);
+
+    return c;
+}
+
+static line::Message make_message() {
+    line::Message m;
+
+    m.from_ = random_mid('u');
+    m.to = random_mid('c');
+    m.toType = line::MIDType::GROUP;
+    m.id = std::to_string(rng());
+    m.createdTime = 1400000000000LL + rng();
+    m.text = random_text(1, 200);
+    m.contentType = line::ContentType::NONE;
+
+    if (rng() % 4 == 0) {
+        m.contentType = line::ContentType::IMAGE;
+        m.contentPreview = random_bytes(100 + rng() % 2000);
+    }
+
+    int n_metadata = rng() % 4;
+    for (int i = 0; i < n_metadata; i++)
+        m.contentMetadata[random_text(3, 12)] = random_text(0, 40);
+
+    if (rng() % 8 == 0) {
+        line::Location loc;
+        loc.title = random_text(5, 30);
+        loc.address = random_text(10, 60);
+        loc.latitude = 35.0 + rng() % 1000 / 1000.0;
+        loc.longitude = -139.0 - rng() % 1000 / 1000.0;
+
+        m.__set_location(loc);
+    }
+
+    return m;
+}
+
+static std::vector<line::Operation> make_operations(int n) {
+    std::vector<line::Operation> ops(n);
+
+    for (int i = 0; i < n; i++) {
+        line::Operation &op = ops[i];
+
+        op.revision = 1000000 + i;
+        op.createdTime = 1400000000000LL + rng();
+        op.type = (i % 5) ? line::OpType::RECEIVE_MESSAGE : line::OpType::NOTIFIED_UPDATE_PROFILE;
+        op.reqSeq = -1;
+        op.param1 = random_mid('u');
+        op.param2 = (i % 3) ? "" : random_text(1, 10);
+        op.message = make_message();
+    }
+
+    return ops;
+}
+
+template <typename T>
+static std::string thrift_encode(const T &v) {
+    boost::shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+    TCompactProtocol proto(buf);
+
+    v.write(&proto);
+
+    return buf->getBufferAsString();
+}
+
+template <typename T>
+static void thrift_decode(const std::string &data, T &v) {
+    boost::shared_ptr<TMemoryBuffer> buf(
+        new TMemoryBuffer((uint8_t *)data.data(), (uint32_t)data.size()));
+    TCompactProtocol proto(buf);
+
+    v.read(&proto);
+}
+
+template <typename T>
+static std::string codec_encode(const T &v) {
+    std::string out;
+    CompactWriter w(out);
+
+    Codec<T>::write(w, v);
+
+    return out;
+}
+
+template <typename T>
+static void codec_decode(const std::string &data, T &v) {
+    CompactReader r((const uint8_t *)data.data(), data.size());
+
+    Codec<T>::read(r, v);
+}
+
+// Fields are declared in ascending order in line.thrift, so both sides should write the exact same
+// bytes, and each should decode the other's output back into the original value
+template <typename T>
+static bool check_struct(const char *name, const T &v) {
+    std::string thrift_bytes = thrift_encode(v), codec_bytes = codec_encode(v);
+
+    if (thrift_bytes != codec_bytes) {
+        fprintf(stderr, "%s: codec output differs from TCompactProtocol\n", name);
+        return false;
+    }
+
+    T from_thrift, from_codec;
+    codec_decode(thrift_bytes, from_thrift);
+    thrift_decode(codec_bytes, from_codec);
+
+    if (!(from_thrift == v)) {
+        fprintf(stderr, "%s: codec didn't decode what TCompactProtocol wrote\n", name);
+        return false;
+    }
+
+    if (!(from_codec == v)) {
+        fprintf(stderr, "%s: TCompactProtocol didn't decode what the codec wrote\n", name);
+        return false;
+    }
+
+    return true;
+}
+
+// The login call is the only bool field, and its argument IDs aren't in order
+static bool check_login_args(bool keep_logged_in) {
+    line::TalkService_loginWithIdentityCredentialForCertificate_args expected;
+
+    expected.identityProvider = line::IdentityProvider::LINE;
+    expected.identifier = "user@example.com";
+    expected.password = random_text(8, 20);
+    expected.keepLoggedIn = keep_logged_in;
+    expected.accessLocation = "127.0.0.1";
+    expected.systemName = "purple-line";
+    expected.certificate = random_text(64, 64);
+
+    {
+        std::string request;
+        CompactWriter w(request);
+
+        line_codec::write_loginWithIdentityCredentialForCertificate(w,
+            expected.identityProvider, expected.identifier, expected.password,
+            expected.keepLoggedIn, expected.accessLocation, expected.systemName,
+            expected.certificate);
+
+        boost::shared_ptr<TMemoryBuffer> buf(
+            new TMemoryBuffer((uint8_t *)request.data(), (uint32_t)request.size()));
+        TCompactProtocol proto(buf);
+
+        std::string name;
+        TMessageType type;
+        int32_t seqid;
+
+        line::TalkService_loginWithIdentityCredentialForCertificate_args args;
+
+        proto.readMessageBegin(name, type, seqid);
+        args.read(&proto);
+        proto.readMessageEnd();
+
+        if (name != "loginWithIdentityCredentialForCertificate" || !(args == expected)) {
+            fprintf(stderr, "TCompactProtocol didn't decode the login call the codec wrote\n");
+            return false;
+        }
+    }
+
+    {
+        boost::shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+        TCompactProtocol proto(buf);
+
+        line::TalkService_loginWithIdentityCredentialForCertificate_pargs pargs;
+        pargs.identityProvider = &expected.identityProvider;
+        pargs.identifier = &expected.identifier;
+        pargs.password = &expected.password;
+        pargs.keepLoggedIn = &expected.keepLoggedIn;
+        pargs.accessLocation = &expected.accessLocation;
+        pargs.systemName = &expected.systemName;
+        pargs.certificate = &expected.certificate;
+
+        proto.writeMessageBegin("loginWithIdentityCredentialForCertificate",
+            apache::thrift::protocol::T_CALL, 0);
+        pargs.write(&proto);
+        proto.writeMessageEnd();
+
+        std::string request = buf->getBufferAsString();
+        CompactReader r((const uint8_t *)request.data(), request.size());
+
+        BufferView name;
+        int32_t seqid;
+
+        line::TalkService_loginWithIdentityCredentialForCertificate_args args;
+
+        r.read_message_begin(name, seqid);
+        r.read_struct_begin();
+
+        int16_t id;
+        int type;
+
+        while (r.read_field(id, type)) {
+            switch (id) {
+                case 3: line_codec::read_field(r, type, args.identifier); break;
+                case 4: line_codec::read_field(r, type, args.password); break;
+                case 5: line_codec::read_field(r, type, args.keepLoggedIn); break;
+                case 6: line_codec::read_field(r, type, args.accessLocation); break;
+                case 7: line_codec::read_field(r, type, args.systemName); break;
+                case 8: line_codec::read_field(r, type, args.identityProvider); break;
+                case 9: line_codec::read_field(r, type, args.certificate); break;
+                default: r.skip(type); break;
+            }
+        }
+
+        if (!name.equals("loginWithIdentityCredentialForCertificate") || !(args == expected)) {
+            fprintf(stderr, "Codec didn't decode the login call TCompactProtocol wrote\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// A reply the way the server sends it
+static std::string thrift_encode_reply(const std::vector<line::Operation> &ops) {
+    boost::shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+    TCompactProtocol proto(buf);
+
+    line::TalkService_fetchOperations_result result;
+    result.success = ops;
+    result.__isset.success = true;
+
+    proto.writeMessageBegin("fetchOperations", apache::thrift::protocol::T_REPLY, 0);
+    result.write(&proto);
+    proto.writeMessageEnd();
+
+    return buf->getBufferAsString();
+}
+
+// Same as TalkServiceClient::recv_fetchOperations
+static void thrift_decode_reply(TCompactProtocol &proto, std::vector<line::Operation> &ops) {
+    std::string name;
+    TMessageType type;
+    int32_t seqid;
+
+    proto.readMessageBegin(name, type, seqid);
+
+    line::TalkService_fetchOperations_presult result;
+    result.success = &ops;
+    result.read(&proto);
+
+    proto.readMessageEnd();
+    proto.getTransport()->readEnd();
+}
+
+static bool check_correctness() {
+    for (int i = 0; i < 200; i++) {
+        if (!check_struct("Contact", make_contact()))
+            return false;
+    }
+
+    // Profile goes from field 1 to 20, which doesn't fit in a short field header
+    line::Profile profile;
+    profile.mid = random_mid('u');
+    profile.displayName = random_text(4, 20);
+    profile.statusMessage = random_text(0, 60);
+    profile.picturePath = "/" + random_text(40, 60);
+
+    if (!check_struct("Profile", profile))
+        return false;
+
+    line::Group group;
+    group.id = random_mid('c');
+    group.name = random_text(5, 30);
+
+    for (int i = 0; i < 40; i++)
+        group.members.push_back(make_contact());
+
+    group.creator = group.members[0];
+    group.invitee.push_back(make_contact());
+
+    if (!check_struct("Group", group))
+        return false;
+
+    line::MessageBoxWrapUpList wrap_up_list;
+
+    for (int i = 0; i < 20; i++) {
+        line::MessageBoxWrapUp ent;
+        ent.messageBox.id = random_mid('r');
+        ent.messageBox.midType = line::MIDType::ROOM;
+        ent.messageBox.lastMessages.push_back(make_message());
+
+        for (int j = 0; j < 4; j++)
+            ent.contacts.push_back(make_contact());
+
+        wrap_up_list.messageBoxWrapUpList.push_back(ent);
+    }
+
+    if (!check_struct("MessageBoxWrapUpList", wrap_up_list))
+        return false;
+
+    for (line::Operation &op: make_operations(500)) {
+        if (!check_struct("Operation", op))
+            return false;
+    }
+
+    if (!check_login_args(true) || !check_login_args(false))
+        return false;
+
+    std::vector<line::Operation> ops = make_operations(N_OPERATIONS), decoded;
+
+    std::string reply = thrift_encode_reply(ops);
+    CompactReader r((const uint8_t *)reply.data(), reply.size());
+    line_codec::read_fetchOperations(r, decoded);
+
+    if (!(decoded == ops)) {
+        fprintf(stderr, "Codec didn't decode the fetchOperations reply\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void benchmark_decode() {
+    std::vector<line::Operation> ops = make_operations(N_OPERATIONS);
+    std::string reply = thrift_encode_reply(ops);
+
+    boost::shared_ptr<TMemoryBuffer> buf(new TMemoryBuffer());
+    TCompactProtocol proto(buf);
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < ROUNDS; i++) {
+        buf->resetBuffer((uint8_t *)reply.data(), (uint32_t)reply.size());
+
+        std::vector<line::Operation> decoded;
+        thrift_decode_reply(proto, decoded);
+        sink = sink + decoded.size();
+    }
+
+    auto t1 = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < ROUNDS; i++) {
+        CompactReader r((const uint8_t *)reply.data(), reply.size());
+
+        std::vector<line::Operation> decoded;
+        line_codec::read_fetchOperations(r, decoded);
+        sink = sink + decoded.size();
+    }
+
+    auto t2 = std::chrono::steady_clock::now();
+
+    double thrift_s = std::chrono::duration<double>(t1 - t0).count(),
+        codec_s = std::chrono::duration<double>(t2 - t1).count();
+
+    printf("fetchOperations reply, %d operations, %zu bytes:\n", N_OPERATIONS, reply.size());
+    printf("  TCompactProtocol %7.1f MB/s, %7.1f us/reply\n",
+        reply.size() * ROUNDS / thrift_s / 1e6, thrift_s * 1e6 / ROUNDS);
+    printf("  codec            %7.1f MB/s, %7.1f us/reply (%.1fx)\n",
+        reply.size() * ROUNDS / codec_s / 1e6, codec_s * 1e6 / ROUNDS, thrift_s / codec_s);
+}
+
+static bool measure_plugin(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Couldn't stat %s\n", path);
+        return false;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    auto t1 = std::chrono::steady_clock::now();
+
+    if (!handle) {
+        fprintf(stderr, "Couldn't load %s: %s\n", path, dlerror());
+        return false;
+    }
+
+    dlclose(handle);
+
+    printf("%s: %lld bytes, loaded in %.2f ms\n", path, (long long)st.st_size,
+        std::chrono::duration<double>(t1 - t0).count() * 1e3);
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (!check_correctness())
+        return 1;
+
+    printf("Codec matches TCompactProtocol\n");
+
+    benchmark_decode();
+
+    if (argc > 1 && !measure_plugin(argv[1]))
+        return 1;
+
+    return 0;
+}
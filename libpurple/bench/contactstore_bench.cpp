@@ -0,0 +1,171 @@
+// Measures the heap usage of ContactStore against the std::maps of Thrift structs it replaced,
+// for a synthetic account. Allocations are counted by replacing the global operator new.
+//
+// Usage: contactstore_bench
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "contactstore.hpp"
+
+static const int N_CONTACTS = 20000;
+static const int N_GROUPS = 300;
+static const int GROUP_SIZE = 60;
+static const int N_ROOMS = 100;
+static const int ROOM_SIZE = 4;
+
+static size_t allocated = 0;
+
+// Each block is prefixed with its size so that frees can be subtracted. Not inlined so that the
+// compiler doesn't see malloc and free paired with new and delete.
+__attribute__((noinline)) void *operator new(size_t n) {
+    size_t *p = (size_t *)malloc(n + 16);
+    if (!p)
+        throw std::bad_alloc();
+
+    *p = n;
+    allocated += n;
+
+    return (char *)p + 16;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    if (!p)
+        return;
+
+    size_t *q = (size_t *)((char *)p - 16);
+    allocated -= *q;
+    free(q);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+static std::mt19937 rng(1);
+
+static std::string random_mid(char type) {
+    std::string s(1, type);
+
+    for (int i = 0; i < 32; i++)
+        s += "0123456789abcdef"[rng() % 16];
+
+    return s;
+}
+
+static std::string random_text(int min, int max) {
+    int n = min + rng() % (max - min + 1);
+    std::string s;
+
+    for (int i = 0; i < n; i++)
+        s += (char)('a' + rng() % 26);
+
+    return s;
+}
+
+int main() {
+    std::vector<line::Contact> contacts(N_CONTACTS);
+
+    for (line::Contact &c: contacts) {
+        c.mid = random_mid('u');
+        c.status = line::ContactStatus::FRIEND;
+        c.displayName = random_text(4, 20);
+        c.statusMessage = (rng() % 2) ? random_text(5, 60) : "";
+        c.attributes = 0;
+        c.picturePath = "/" + random_text(40, 60);
+    }
+
+    std::vector<line::Group> groups(N_GROUPS);
+
+    for (line::Group &g: groups) {
+        g.id = random_mid('c');
+        g.name = random_text(5, 30);
+
+        for (int i = 0; i < GROUP_SIZE; i++)
+            g.members.push_back(contacts[rng() % N_CONTACTS]);
+
+        g.creator = g.members[0];
+    }
+
+    std::vector<line::Room> rooms(N_ROOMS);
+
+    for (line::Room &r: rooms) {
+        r.mid = random_mid('r');
+
+        // Room contacts only come with their MID
+        for (int i = 0; i < ROOM_SIZE; i++) {
+            line::Contact c;
+            c.mid = contacts[rng() % N_CONTACTS].mid;
+            r.contacts.push_back(c);
+        }
+    }
+
+    size_t before, old_size, new_size, estimate;
+
+    {
+        before = allocated;
+
+        auto *c = new std::map<std::string, line::Contact>();
+        auto *g = new std::map<std::string, line::Group>();
+        auto *r = new std::map<std::string, line::Room>();
+
+        for (line::Contact &x: contacts)
+            (*c)[x.mid] = x;
+
+        for (line::Group &x: groups)
+            (*g)[x.id] = x;
+
+        for (line::Room &x: rooms)
+            (*r)[x.mid] = x;
+
+        old_size = allocated - before;
+
+        delete c;
+        delete g;
+        delete r;
+    }
+
+    {
+        before = allocated;
+
+        ContactStore *store = new ContactStore();
+
+        for (line::Contact &x: contacts)
+            store->update_contact(x);
+
+        for (line::Group &x: groups)
+            store->update_group(x);
+
+        for (line::Room &x: rooms)
+            store->update_room(x);
+
+        new_size = allocated - before;
+        estimate = store->memory_usage();
+
+        for (line::Contact &x: contacts) {
+            if (store->mid(store->intern(x.mid)) != x.mid
+                || store->update_contact(x) != store->get_contact(x.mid))
+            {
+                fprintf(stderr, "ContactStore didn't return the stored contact %s\n",
+                    x.mid.c_str());
+                return 1;
+            }
+        }
+
+        delete store;
+    }
+
+    printf("%d contacts, %d groups of %d, %d rooms of %d\n",
+        N_CONTACTS, N_GROUPS, GROUP_SIZE, N_ROOMS, ROOM_SIZE);
+    printf("std::map + Thrift structs: %zu bytes\n", old_size);
+    printf("ContactStore:              %zu bytes\n", new_size);
+    printf("memory_usage() estimate:   %zu bytes\n", estimate);
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+// Compares markup_escape_append with the escape path it replaced: purple_markup_escape_text into
+// a malloc'd buffer that was then copied into a std::string and freed. The libpurple 2.x function
+// is transcribed here so that the benchmark runs without libpurple. The output of both is also
+// checked against each other, along with invalid UTF-8 handling.
+//
+// Usage: markup_bench corpus.txt...
+//
+// Each line of a corpus file is one message.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "markup.hpp"
+
+// Number of times each corpus is escaped for timing
+static const int ROUNDS = 2000;
+
+static std::mt19937 rng(42);
+
+// Keeps the escaped output from being optimized away
+static volatile size_t sink;
+
+// purple_markup_escape_text from libpurple 2.x util.c, which assumes valid UTF-8, and the copy of
+// the old markup_escape wrapper, which stopped at the first NUL
+static std::string reference_escape(const std::string &text) {
+    static const unsigned char utf8_skip[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 3, 4 };
+
+    const char *p = text.data(), *end = p + text.size();
+    std::string escaped;
+
+    while (p != end) {
+        const char *next = p + utf8_skip[(unsigned char)*p >> 4];
+
+        switch (*p) {
+            case '&': escaped += "&amp;"; break;
+            case '<': escaped += "&lt;"; break;
+            case '>': escaped += "&gt;"; break;
+            case '"': escaped += "&quot;"; break;
+            default: escaped.append(p, next - p); break;
+        }
+
+        p = next;
+    }
+
+    char *buf = (char *)malloc(escaped.size() + 1);
+    memcpy(buf, escaped.c_str(), escaped.size() + 1);
+
+    std::string result(buf);
+    free(buf);
+
+    return result;
+}
+
+static void put_utf8(std::string &s, uint32_t cp) {
+    if (cp < 0x80) {
+        s += (char)cp;
+    } else if (cp < 0x800) {
+        s += (char)(0xc0 | (cp >> 6));
+        s += (char)(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        s += (char)(0xe0 | (cp >> 12));
+        s += (char)(0x80 | ((cp >> 6) & 0x3f));
+        s += (char)(0x80 | (cp & 0x3f));
+    } else {
+        s += (char)(0xf0 | (cp >> 18));
+        s += (char)(0x80 | ((cp >> 12) & 0x3f));
+        s += (char)(0x80 | ((cp >> 6) & 0x3f));
+        s += (char)(0x80 | (cp & 0x3f));
+    }
+}
+
+static bool check_correctness(const std::vector<std::vector<std::string>> &corpora) {
+    for (auto &corpus: corpora) {
+        for (const std::string &msg: corpus) {
+            if (markup_escape(msg) != reference_escape(msg)) {
+                fprintf(stderr, "Mismatch for corpus message: %s\n", msg.c_str());
+                return false;
+            }
+        }
+    }
+
+    // Random valid UTF-8, weighted towards ASCII, Latin-1 and control characters, which are all
+    // passed as is
+    for (int i = 0; i < 200000; i++) {
+        std::string s;
+
+        int n = rng() % 40;
+        for (int j = 0; j < n; j++) {
+            uint32_t cp = (rng() % 5) ? (rng() % 0x200) : (rng() % 0x110000);
+            if (cp == 0 || (cp >= 0xd800 && cp <= 0xdfff))
+                cp = 'x';
+
+            put_utf8(s, cp);
+        }
+
+        if (markup_escape(s) != reference_escape(s)) {
+            fprintf(stderr, "Mismatch for random text\n");
+            return false;
+        }
+    }
+
+    // Invalid UTF-8 and NUL bytes become U+FFFD. Apostrophes and control characters are kept as
+    // they were.
+    static const struct {
+        const char *in;
+        size_t in_len;
+        const char *out;
+    } invalid[] = {
+        { "a\xff" "b", 3, "a\xef\xbf\xbd" "b" },
+        { "\xc0\xaf", 2, "\xef\xbf\xbd\xef\xbf\xbd" },
+        { "\xed\xa0\x80", 3, "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd" },
+        { "\xe3\x81", 2, "\xef\xbf\xbd\xef\xbf\xbd" },
+        { "\xf4\x90\x80\x80", 4, "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd" },
+        { "0123456789abcdef\x80<", 18, "0123456789abcdef\xef\xbf\xbd&lt;" },
+        { "a\0b", 3, "a\xef\xbf\xbd" "b" },
+        { "it's \x01\x1f\x7f\xc2\x85", 10, "it's \x01\x1f\x7f\xc2\x85" },
+    };
+
+    for (auto &t: invalid) {
+        if (markup_escape(std::string(t.in, t.in_len)) != t.out) {
+            fprintf(stderr, "Wrong output for invalid UTF-8 case %s\n", t.out);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s corpus.txt...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::vector<std::string>> corpora;
+
+    for (int i = 1; i < argc; i++) {
+        std::ifstream f(argv[i]);
+        if (!f) {
+            fprintf(stderr, "Couldn't open %s\n", argv[i]);
+            return 1;
+        }
+
+        corpora.emplace_back();
+
+        std::string line;
+        while (std::getline(f, line))
+            corpora.back().push_back(line);
+    }
+
+    if (!check_correctness(corpora))
+        return 1;
+
+    printf("Output matches the reference\n");
+
+    for (size_t c = 0; c < corpora.size(); c++) {
+        const std::vector<std::string> &corpus = corpora[c];
+
+        size_t bytes = 0;
+        for (const std::string &msg: corpus)
+            bytes += msg.size();
+
+        auto t0 = std::chrono::steady_clock::now();
+
+        for (int r = 0; r < ROUNDS; r++) {
+            for (const std::string &msg: corpus)
+                sink = sink + reference_escape(msg).size();
+        }
+
+        auto t1 = std::chrono::steady_clock::now();
+
+        for (int r = 0; r < ROUNDS; r++) {
+            for (const std::string &msg: corpus) {
+                std::string out;
+                markup_escape_append(out, msg.data(), msg.size());
+                sink = sink + out.size();
+            }
+        }
+
+        auto t2 = std::chrono::steady_clock::now();
+
+        double old_s = std::chrono::duration<double>(t1 - t0).count(),
+            new_s = std::chrono::duration<double>(t2 - t1).count();
+
+        printf("%-30s %4zu messages, %3zu B/msg: old %7.1f MB/s, new %7.1f MB/s (%.1fx)\n",
+            argv[c + 1], corpus.size(), bytes / (corpus.size() ? corpus.size() : 1),
+            bytes * ROUNDS / old_s / 1e6, bytes * ROUNDS / new_s / 1e6, old_s / new_s);
+    }
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <thrift/TApplicationException.h>
+#include <thrift/protocol/TProtocol.h>
+
+#include "compactreader.hpp"
+#include "compactwriter.hpp"
+
+// Statically dispatched compact protocol codec. Codec<T> reads and writes values of type T
+// directly from and to buffers. The specializations for LINE types are generated from line.thrift
+// into thrift_line/line_codec.hpp by gen_codec.py.
+//
+// Each codec has TYPE, the compact type used for the value in field and collection headers, is()
+// which checks if a type read from a header matches, and read() and write().
+
+namespace line_codec {
+
+template <typename T, typename Enable=void>
+struct Codec;
+
+template <>
+struct Codec<bool> {
+    static const int TYPE = CompactReader::BOOL_TRUE;
+
+    static bool is(int type) {
+        return type == CompactReader::BOOL_TRUE || type == CompactReader::BOOL_FALSE;
+    }
+
+    static void read(CompactReader &r, bool &v) { v = r.read_bool(); }
+    static void write(CompactWriter &w, bool v) { w.write_bool(v); }
+};
+
+template <>
+struct Codec<int32_t> {
+    static const int TYPE = CompactReader::I32;
+
+    static bool is(int type) { return type == TYPE; }
+
+    static void read(CompactReader &r, int32_t &v) { v = r.read_i32(); }
+    static void write(CompactWriter &w, int32_t v) { w.write_i32(v); }
+};
+
+template <>
+struct Codec<int64_t> {
+    static const int TYPE = CompactReader::I64;
+
+    static bool is(int type) { return type == TYPE; }
+
+    static void read(CompactReader &r, int64_t &v) { v = r.read_i64(); }
+    static void write(CompactWriter &w, int64_t v) { w.write_i64(v); }
+};
+
+template <>
+struct Codec<double> {
+    static const int TYPE = CompactReader::DOUBLE;
+
+    static bool is(int type) { return type == TYPE; }
+
+    static void read(CompactReader &r, double &v) { v = r.read_double(); }
+    static void write(CompactWriter &w, double v) { w.write_double(v); }
+};
+
+template <>
+struct Codec<std::string> {
+    static const int TYPE = CompactReader::BINARY;
+
+    static bool is(int type) { return type == TYPE; }
+
+    static void read(CompactReader &r, std::string &v) { r.read_string(v); }
+    static void write(CompactWriter &w, const std::string &v) { w.write_binary(v); }
+};
+
+// Enums are sent as i32
+template <typename T>
+struct Codec<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+    static const int TYPE = CompactReader::I32;
+
+    static bool is(int type) { return type == TYPE; }
+
+    static void read(CompactReader &r, T &v) { v = (T)r.read_i32(); }
+    static void write(CompactWriter &w, T v) { w.write_i32((int32_t)v); }
+};
+
+template <typename T>
+struct Codec<std::vector<T>> {
+    static const int TYPE = CompactReader::LIST;
+
+    static bool is(int type) { return type == TYPE || type == CompactReader::SET; }
+
+    static void read(CompactReader &r, std::vector<T> &v) {
+        int elem_type;
+        uint32_t size = r.read_list_begin(elem_type);
+
+        v.clear();
+
+        if (size > 0 && !Codec<T>::is(elem_type)) {
+            for (uint32_t i = 0; i < size; i++)
+                r.skip(elem_type);
+
+            return;
+        }
+
+        v.resize(size);
+
+        for (uint32_t i = 0; i < size; i++)
+            Codec<T>::read(r, v[i]);
+    }
+
+    static void write(CompactWriter &w, const std::vector<T> &v) {
+        w.write_list_begin(Codec<T>::TYPE, (uint32_t)v.size());
+
+        for (const T &elem: v)
+            Codec<T>::write(w, elem);
+    }
+};
+
+template <typename K, typename V>
+struct Codec<std::map<K, V>> {
+    static const int TYPE = CompactReader::MAP;
+
+    static bool is(int type) { return type == TYPE; }
+
+    static void read(CompactReader &r, std::map<K, V> &v) {
+        int key_type, value_type;
+        uint32_t size = r.read_map_begin(key_type, value_type);
+
+        v.clear();
+
+        if (size > 0 && !(Codec<K>::is(key_type) && Codec<V>::is(value_type))) {
+            for (uint32_t i = 0; i < size; i++) {
+                r.skip(key_type);
+                r.skip(value_type);
+            }
+
+            return;
+        }
+
+        for (uint32_t i = 0; i < size; i++) {
+            K key;
+            Codec<K>::read(r, key);
+            Codec<V>::read(r, v[key]);
+        }
+    }
+
+    static void write(CompactWriter &w, const std::map<K, V> &v) {
+        w.write_map_begin(Codec<K>::TYPE, Codec<V>::TYPE, (uint32_t)v.size());
+
+        for (auto &p: v) {
+            Codec<K>::write(w, p.first);
+            Codec<V>::write(w, p.second);
+        }
+    }
+};
+
+// Reads a field of a known type, or skips it if the type doesn't match. Returns true if the field
+// was read.
+template <typename T>
+inline bool read_field(CompactReader &r, int type, T &v) {
+    if (!Codec<T>::is(type)) {
+        r.skip(type);
+        return false;
+    }
+
+    Codec<T>::read(r, v);
+    return true;
+}
+
+template <typename T>
+inline void write_field(CompactWriter &w, int16_t id, const T &v) {
+    w.write_field(id, Codec<T>::TYPE);
+    Codec<T>::write(w, v);
+}
+
+// Reads the header of a reply to method. Server side application errors are thrown as
+// TApplicationException, same as the generated recv_* functions do.
+inline void read_reply_begin(CompactReader &r, const char *method) {
+    using apache::thrift::TApplicationException;
+
+    BufferView name;
+    int32_t seqid;
+
+    int type = r.read_message_begin(name, seqid);
+
+    if (type == apache::thrift::protocol::T_EXCEPTION) {
+        std::string message;
+        int32_t ex_type = TApplicationException::UNKNOWN;
+
+        int16_t id;
+        int field_type;
+
+        r.read_struct_begin();
+
+        while (r.read_field(id, field_type)) {
+            if (id == 1)
+                read_field(r, field_type, message);
+            else if (id == 2)
+                read_field(r, field_type, ex_type);
+            else
+                r.skip(field_type);
+        }
+
+        throw TApplicationException(
+            (TApplicationException::TApplicationExceptionType)ex_type, message);
+    }
+
+    if (type != apache::thrift::protocol::T_REPLY)
+        throw TApplicationException(TApplicationException::INVALID_MESSAGE_TYPE);
+
+    if (!name.equals(method))
+        throw TApplicationException(TApplicationException::WRONG_METHOD_NAME);
+}
+
+}
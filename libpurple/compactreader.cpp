@@ -0,0 +1,266 @@
+#include <string.h>
+
+#include <thrift/protocol/TProtocolException.h>
+#include <thrift/transport/TTransportException.h>
+
+#include "compactreader.hpp"
+
+using apache::thrift::protocol::TProtocolException;
+using apache::thrift::transport::TTransportException;
+
+static const uint8_t PROTOCOL_ID = 0x82;
+static const uint8_t VERSION = 1;
+
+static inline int64_t unzigzag(uint64_t n) {
+    return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+}
+
+bool BufferView::equals(const char *s) const {
+    size_t len = strlen(s);
+
+    return len == size && memcmp(data, s, len) == 0;
+}
+
+CompactReader::CompactReader(const uint8_t *data, size_t len) :
+    pos(data),
+    end(data + len),
+    depth(0),
+    bool_pending(false),
+    bool_value(false)
+{
+}
+
+const uint8_t *CompactReader::take(size_t len) {
+    if ((size_t)(end - pos) < len)
+        throw TTransportException(TTransportException::END_OF_FILE, "Unexpected end of response");
+
+    const uint8_t *p = pos;
+    pos += len;
+
+    return p;
+}
+
+uint64_t CompactReader::read_varint() {
+    uint64_t value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = *take(1);
+
+        value |= (uint64_t)(b & 0x7f) << shift;
+
+        if (!(b & 0x80))
+            return value;
+    }
+
+    throw TProtocolException(TProtocolException::INVALID_DATA, "Variable-length int over 10 bytes");
+}
+
+// Every element takes at least a byte, so larger counts can't be valid. Checking this keeps
+// callers from reserving huge amounts of memory for garbage.
+void CompactReader::check_size(uint64_t count, size_t min_elem_size) {
+    if (count > (uint64_t)(end - pos) / min_elem_size)
+        throw TProtocolException(TProtocolException::SIZE_LIMIT, "Collection is too large");
+}
+
+int CompactReader::read_message_begin(BufferView &name, int32_t &seqid) {
+    if (*take(1) != PROTOCOL_ID)
+        throw TProtocolException(TProtocolException::BAD_VERSION, "Bad protocol identifier");
+
+    uint8_t version_and_type = *take(1);
+
+    if ((version_and_type & 0x1f) != VERSION)
+        throw TProtocolException(TProtocolException::BAD_VERSION, "Bad protocol version");
+
+    seqid = (int32_t)read_varint();
+    name = read_binary();
+
+    return (version_and_type >> 5) & 0x07;
+}
+
+void CompactReader::read_struct_begin() {
+    if (depth == MAX_DEPTH)
+        throw TProtocolException(TProtocolException::DEPTH_LIMIT, "Structs nested too deep");
+
+    last_field_id[depth++] = 0;
+}
+
+bool CompactReader::read_field(int16_t &id, int &type) {
+    uint8_t b = *take(1);
+
+    type = b & 0x0f;
+
+    if (type == STOP) {
+        depth--;
+        return false;
+    }
+
+    int16_t delta = b >> 4;
+
+    id = delta ? (int16_t)(last_field_id[depth - 1] + delta) : read_i16();
+    last_field_id[depth - 1] = id;
+
+    if (type == BOOL_TRUE || type == BOOL_FALSE) {
+        bool_pending = true;
+        bool_value = (type == BOOL_TRUE);
+    }
+
+    return true;
+}
+
+bool CompactReader::read_bool() {
+    if (bool_pending) {
+        bool_pending = false;
+        return bool_value;
+    }
+
+    // Bools inside collections are sent as bytes
+    return *take(1) == BOOL_TRUE;
+}
+
+int8_t CompactReader::read_byte() {
+    return (int8_t)*take(1);
+}
+
+int16_t CompactReader::read_i16() {
+    return (int16_t)unzigzag(read_varint());
+}
+
+int32_t CompactReader::read_i32() {
+    return (int32_t)unzigzag(read_varint());
+}
+
+int64_t CompactReader::read_i64() {
+    return unzigzag(read_varint());
+}
+
+double CompactReader::read_double() {
+    const uint8_t *p = take(8);
+
+    uint64_t bits = 0;
+    for (int i = 7; i >= 0; i--)
+        bits = (bits << 8) | p[i];
+
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+BufferView CompactReader::read_binary() {
+    uint64_t len = read_varint();
+
+    if (len > (uint64_t)(end - pos))
+        throw TTransportException(TTransportException::END_OF_FILE, "Unexpected end of response");
+
+    return BufferView(take((size_t)len), (size_t)len);
+}
+
+void CompactReader::read_string(std::string &out) {
+    BufferView v = read_binary();
+
+    out.assign((const char *)v.data, v.size);
+}
+
+uint32_t CompactReader::read_list_begin(int &elem_type) {
+    uint8_t b = *take(1);
+
+    elem_type = b & 0x0f;
+
+    uint64_t size = b >> 4;
+    if (size == 15)
+        size = read_varint();
+
+    check_size(size, 1);
+
+    return (uint32_t)size;
+}
+
+uint32_t CompactReader::read_map_begin(int &key_type, int &value_type) {
+    uint64_t size = read_varint();
+
+    if (size == 0) {
+        key_type = value_type = STOP;
+        return 0;
+    }
+
+    uint8_t types = *take(1);
+
+    key_type = types >> 4;
+    value_type = types & 0x0f;
+
+    check_size(size, 2);
+
+    return (uint32_t)size;
+}
+
+void CompactReader::skip(int type) {
+    skip(type, 0);
+}
+
+void CompactReader::skip(int type, int nesting) {
+    if (nesting == MAX_DEPTH)
+        throw TProtocolException(TProtocolException::DEPTH_LIMIT, "Values nested too deep");
+
+    switch (type) {
+        case BOOL_TRUE:
+        case BOOL_FALSE:
+            read_bool();
+            break;
+
+        case BYTE:
+            take(1);
+            break;
+
+        case I16:
+        case I32:
+        case I64:
+            read_varint();
+            break;
+
+        case DOUBLE:
+            take(8);
+            break;
+
+        case BINARY:
+            read_binary();
+            break;
+
+        case LIST:
+        case SET:
+            {
+                int elem_type;
+                uint32_t size = read_list_begin(elem_type);
+
+                for (uint32_t i = 0; i < size; i++)
+                    skip(elem_type, nesting + 1);
+            }
+            break;
+
+        case MAP:
+            {
+                int key_type, value_type;
+                uint32_t size = read_map_begin(key_type, value_type);
+
+                for (uint32_t i = 0; i < size; i++) {
+                    skip(key_type, nesting + 1);
+                    skip(value_type, nesting + 1);
+                }
+            }
+            break;
+
+        case STRUCT:
+            {
+                int16_t id;
+                int field_type;
+
+                read_struct_begin();
+
+                while (read_field(id, field_type))
+                    skip(field_type, nesting + 1);
+            }
+            break;
+
+        default:
+            throw TProtocolException(TProtocolException::INVALID_DATA, "Unknown type");
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+// Bytes in a buffer owned by somebody else
+struct BufferView {
+    const uint8_t *data;
+    size_t size;
+
+    BufferView() : data(nullptr), size(0) { }
+    BufferView(const uint8_t *data, size_t size) : data(data), size(size) { }
+
+    std::string str() const { return std::string((const char *)data, size); }
+
+    bool equals(const char *s) const;
+};
+
+// Reads the Thrift compact protocol straight from a buffer. Strings can be read as views into the
+// buffer, and skipped values are never copied anywhere, which makes it cheap to decode only the
+// fields a caller needs. Malformed input throws the same exceptions as TCompactProtocol.
+class CompactReader {
+
+public:
+
+    enum Type {
+        STOP = 0,
+        BOOL_TRUE = 1,
+        BOOL_FALSE = 2,
+        BYTE = 3,
+        I16 = 4,
+        I32 = 5,
+        I64 = 6,
+        DOUBLE = 7,
+        BINARY = 8,
+        LIST = 9,
+        SET = 10,
+        MAP = 11,
+        STRUCT = 12,
+    };
+
+private:
+
+    static const int MAX_DEPTH = 64;
+
+    const uint8_t *pos;
+    const uint8_t *end;
+
+    // Field IDs are sent as deltas from the previous field of the same struct
+    int16_t last_field_id[MAX_DEPTH];
+    int depth;
+
+    // Bool fields carry their value in the field header
+    bool bool_pending;
+    bool bool_value;
+
+public:
+
+    CompactReader(const uint8_t *data, size_t len);
+
+    // Returns the message type (T_CALL, T_REPLY etc.)
+    int read_message_begin(BufferView &name, int32_t &seqid);
+
+    void read_struct_begin();
+    // Returns false at the end of the struct, which also ends reading it
+    bool read_field(int16_t &id, int &type);
+
+    bool read_bool();
+    int8_t read_byte();
+    int16_t read_i16();
+    int32_t read_i32();
+    int64_t read_i64();
+    double read_double();
+    BufferView read_binary();
+    void read_string(std::string &out);
+
+    uint32_t read_list_begin(int &elem_type);
+    uint32_t read_map_begin(int &key_type, int &value_type);
+
+    void skip(int type);
+
+private:
+
+    void skip(int type, int nesting);
+
+    uint64_t read_varint();
+    const uint8_t *take(size_t len);
+    void check_size(uint64_t count, size_t min_elem_size);
+
+};
@@ -0,0 +1,137 @@
+#include <string.h>
+
+#include <thrift/protocol/TProtocolException.h>
+
+#include "compactreader.hpp"
+#include "compactwriter.hpp"
+
+using apache::thrift::protocol::TProtocolException;
+
+static const uint8_t PROTOCOL_ID = 0x82;
+static const uint8_t VERSION = 1;
+
+static inline uint64_t zigzag(int64_t n) {
+    return ((uint64_t)n << 1) ^ (uint64_t)(n >> 63);
+}
+
+CompactWriter::CompactWriter(std::string &out) :
+    out(out),
+    depth(0),
+    bool_pending(false),
+    bool_field_id(0)
+{
+}
+
+void CompactWriter::write_varint(uint64_t n) {
+    while (n >= 0x80) {
+        out.push_back((char)((n & 0x7f) | 0x80));
+        n >>= 7;
+    }
+
+    out.push_back((char)n);
+}
+
+void CompactWriter::write_message_begin(const char *name, int type, int32_t seqid) {
+    out.push_back((char)PROTOCOL_ID);
+    out.push_back((char)(VERSION | (type << 5)));
+    write_varint((uint32_t)seqid);
+
+    size_t len = strlen(name);
+    write_varint(len);
+    out.append(name, len);
+}
+
+void CompactWriter::write_struct_begin() {
+    if (depth == MAX_DEPTH)
+        throw TProtocolException(TProtocolException::DEPTH_LIMIT, "Structs nested too deep");
+
+    last_field_id[depth++] = 0;
+}
+
+void CompactWriter::write_struct_end() {
+    out.push_back((char)CompactReader::STOP);
+    depth--;
+}
+
+void CompactWriter::write_field(int16_t id, int type) {
+    if (type == CompactReader::BOOL_TRUE || type == CompactReader::BOOL_FALSE) {
+        bool_pending = true;
+        bool_field_id = id;
+        return;
+    }
+
+    write_field_header(id, type);
+}
+
+void CompactWriter::write_field_header(int16_t id, int type) {
+    int16_t delta = id - last_field_id[depth - 1];
+
+    if (delta > 0 && delta <= 15) {
+        out.push_back((char)((delta << 4) | type));
+    } else {
+        out.push_back((char)type);
+        write_i16(id);
+    }
+
+    last_field_id[depth - 1] = id;
+}
+
+void CompactWriter::write_bool(bool value) {
+    int type = value ? CompactReader::BOOL_TRUE : CompactReader::BOOL_FALSE;
+
+    if (bool_pending) {
+        bool_pending = false;
+        write_field_header(bool_field_id, type);
+        return;
+    }
+
+    // Bools inside collections are written as bytes
+    out.push_back((char)type);
+}
+
+void CompactWriter::write_byte(int8_t value) {
+    out.push_back((char)value);
+}
+
+void CompactWriter::write_i16(int16_t value) {
+    write_varint(zigzag(value));
+}
+
+void CompactWriter::write_i32(int32_t value) {
+    write_varint(zigzag(value));
+}
+
+void CompactWriter::write_i64(int64_t value) {
+    write_varint(zigzag(value));
+}
+
+void CompactWriter::write_double(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    for (int i = 0; i < 8; i++) {
+        out.push_back((char)(bits & 0xff));
+        bits >>= 8;
+    }
+}
+
+void CompactWriter::write_binary(const std::string &value) {
+    write_varint(value.size());
+    out.append(value);
+}
+
+void CompactWriter::write_list_begin(int elem_type, uint32_t size) {
+    if (size < 15) {
+        out.push_back((char)((size << 4) | elem_type));
+    } else {
+        out.push_back((char)(0xf0 | elem_type));
+        write_varint(size);
+    }
+}
+
+void CompactWriter::write_map_begin(int key_type, int value_type, uint32_t size) {
+    write_varint(size);
+
+    if (size > 0)
+        out.push_back((char)((key_type << 4) | value_type));
+}
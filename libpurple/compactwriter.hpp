@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+// Writes the Thrift compact protocol into a contiguous buffer. The counterpart of CompactReader.
+class CompactWriter {
+
+    static const int MAX_DEPTH = 64;
+
+    std::string &out;
+
+    int16_t last_field_id[MAX_DEPTH];
+    int depth;
+
+    // Bool fields carry their value in the field header, so the header is written by write_bool
+    bool bool_pending;
+    int16_t bool_field_id;
+
+public:
+
+    CompactWriter(std::string &out);
+
+    void write_message_begin(const char *name, int type, int32_t seqid);
+
+    void write_struct_begin();
+    void write_struct_end();
+    void write_field(int16_t id, int type);
+
+    void write_bool(bool value);
+    void write_byte(int8_t value);
+    void write_i16(int16_t value);
+    void write_i32(int32_t value);
+    void write_i64(int64_t value);
+    void write_double(double value);
+    void write_binary(const std::string &value);
+
+    void write_list_begin(int elem_type, uint32_t size);
+    void write_map_begin(int key_type, int value_type, uint32_t size);
+
+private:
+
+    void write_field_header(int16_t id, int type);
+    void write_varint(uint64_t n);
+
+};
@@ -18,3 +18,12 @@
 
 #define LINE_ACCOUNT_CERTIFICATE "line-certificate"
 #define LINE_ACCOUNT_AUTH_TOKEN "line-auth-token"
+
+#define LINE_ACCOUNT_SCALE_IMAGES "line-scale-images"
+#define LINE_ACCOUNT_IMAGE_MAX_SIZE "line-image-max-size"
+#define LINE_ACCOUNT_IMAGE_QUALITY "line-image-quality"
+#define LINE_ACCOUNT_PREVIEW_CACHE_SIZE "line-preview-cache-size"
+#define LINE_ACCOUNT_DEDUP_WINDOW "line-dedup-window"
+#define LINE_ACCOUNT_LAZY_MEMBERS_THRESHOLD "line-lazy-members-threshold"
+#define LINE_ACCOUNT_BACKGROUND_DECODE "line-background-decode"
+#define LINE_ACCOUNT_STATS_INTERVAL "line-stats-interval"
@@ -0,0 +1,233 @@
+#include "contactstore.hpp"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    return -1;
+}
+
+static size_t string_heap(const std::string &s) {
+    // Short strings are stored inline
+    return (s.capacity() > 15) ? s.capacity() + 1 : 0;
+}
+
+template <typename Map>
+static size_t table_overhead(const Map &map) {
+    return map.bucket_count() * sizeof(void *)
+        + map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void *));
+}
+
+size_t MidTable::PackedHash::operator()(const MidTable::Packed &p) const {
+    // The hex digits of MIDs are random enough to use directly
+    size_t h = p[0];
+
+    for (size_t i = 1; i < sizeof(size_t) + 1; i++)
+        h = (h << 8) ^ p[i];
+
+    return h;
+}
+
+bool MidTable::pack(const std::string &mid, MidTable::Packed &p) {
+    if (mid.size() != 33)
+        return false;
+
+    p[0] = (uint8_t)mid[0];
+
+    for (size_t i = 0; i < 16; i++) {
+        int hi = hex_value(mid[1 + i * 2]), lo = hex_value(mid[2 + i * 2]);
+        if (hi < 0 || lo < 0)
+            return false;
+
+        p[1 + i] = (uint8_t)((hi << 4) | lo);
+    }
+
+    return true;
+}
+
+MidId MidTable::intern(const std::string &mid) {
+    MidId id = find(mid);
+    if (id)
+        return id;
+
+    Packed p;
+    if (pack(mid, p)) {
+        packed.push_back(p);
+        id = (MidId)packed.size();
+        packed_index[p] = id;
+    } else {
+        other.push_back(mid);
+        id = OTHER_BIT | (MidId)other.size();
+        other_index[mid] = id;
+    }
+
+    return id;
+}
+
+MidId MidTable::find(const std::string &mid) const {
+    Packed p;
+    if (pack(mid, p)) {
+        auto i = packed_index.find(p);
+        return (i == packed_index.end()) ? 0 : i->second;
+    }
+
+    auto i = other_index.find(mid);
+    return (i == other_index.end()) ? 0 : i->second;
+}
+
+std::string MidTable::str(MidId id) const {
+    if (id & OTHER_BIT) {
+        size_t index = (id & ~OTHER_BIT) - 1;
+        return (index < other.size()) ? other[index] : "";
+    }
+
+    if (id == 0 || id > packed.size())
+        return "";
+
+    const Packed &p = packed[id - 1];
+
+    std::string mid(33, '\0');
+    mid[0] = (char)p[0];
+
+    for (size_t i = 0; i < 16; i++) {
+        mid[1 + i * 2] = hex_digits[p[1 + i] >> 4];
+        mid[2 + i * 2] = hex_digits[p[1 + i] & 0xf];
+    }
+
+    return mid;
+}
+
+size_t MidTable::memory_usage() const {
+    size_t total = packed.capacity() * sizeof(Packed)
+        + other.capacity() * sizeof(std::string)
+        + table_overhead(packed_index)
+        + table_overhead(other_index);
+
+    for (const std::string &s: other)
+        total += string_heap(s) * 2;
+
+    return total;
+}
+
+ContactPtr ContactStore::get_contact(MidId id) const {
+    auto i = contacts.find(id);
+    return (i == contacts.end()) ? ContactPtr() : i->second;
+}
+
+ContactPtr ContactStore::get_contact(const std::string &mid) const {
+    MidId id = mids.find(mid);
+    return id ? get_contact(id) : ContactPtr();
+}
+
+ContactPtr ContactStore::update_contact(const line::Contact &contact) {
+    MidId id = mids.intern(contact.mid);
+
+    ContactPtr &current = contacts[id];
+
+    if (current
+        && current->status == contact.status
+        && current->attributes == contact.attributes
+        && current->displayName == contact.displayName
+        && current->statusMessage == contact.statusMessage
+        && current->picturePath == contact.picturePath)
+    {
+        return current;
+    }
+
+    std::shared_ptr<ContactInfo> info = std::make_shared<ContactInfo>();
+    info->mid = id;
+    info->status = contact.status;
+    info->attributes = contact.attributes;
+    info->displayName = contact.displayName;
+    info->statusMessage = contact.statusMessage;
+    info->picturePath = contact.picturePath;
+
+    current = info;
+
+    return current;
+}
+
+MidId ContactStore::store_member(const line::Contact &contact) {
+    MidId id = mids.intern(contact.mid);
+
+    if (!contacts.count(id))
+        update_contact(contact);
+
+    return id;
+}
+
+const GroupInfo *ContactStore::get_group(const std::string &id) const {
+    auto i = groups.find(mids.find(id));
+    return (i == groups.end()) ? nullptr : &i->second;
+}
+
+const GroupInfo &ContactStore::update_group(const line::Group &group) {
+    MidId id = mids.intern(group.id);
+
+    GroupInfo &info = groups[id];
+    info.id = id;
+    info.name = group.name;
+    info.creator = group.creator.mid.empty() ? 0 : mids.intern(group.creator.mid);
+
+    info.members.clear();
+    info.members.reserve(group.members.size());
+    for (const line::Contact &c: group.members)
+        info.members.push_back(store_member(c));
+
+    info.invitee.clear();
+    info.invitee.reserve(group.invitee.size());
+    for (const line::Contact &c: group.invitee)
+        info.invitee.push_back(store_member(c));
+
+    return info;
+}
+
+const RoomInfo *ContactStore::get_room(const std::string &mid) const {
+    auto i = rooms.find(mids.find(mid));
+    return (i == rooms.end()) ? nullptr : &i->second;
+}
+
+const RoomInfo &ContactStore::update_room(const line::Room &room) {
+    MidId id = mids.intern(room.mid);
+
+    RoomInfo &info = rooms[id];
+    info.id = id;
+
+    info.contacts.clear();
+    info.contacts.reserve(room.contacts.size());
+    for (const line::Contact &c: room.contacts)
+        info.contacts.push_back(mids.intern(c.mid));
+
+    return info;
+}
+
+size_t ContactStore::memory_usage() const {
+    size_t total = mids.memory_usage()
+        + table_overhead(contacts)
+        + table_overhead(groups)
+        + table_overhead(rooms);
+
+    for (auto &p: contacts) {
+        // make_shared puts the control block and the snapshot in one allocation
+        total += sizeof(ContactInfo) + 2 * sizeof(void *) + 2 * sizeof(int)
+            + string_heap(p.second->displayName)
+            + string_heap(p.second->statusMessage)
+            + string_heap(p.second->picturePath);
+    }
+
+    for (auto &p: groups) {
+        total += string_heap(p.second.name)
+            + p.second.members.capacity() * sizeof(MidId)
+            + p.second.invitee.capacity() * sizeof(MidId);
+    }
+
+    for (auto &p: rooms)
+        total += p.second.contacts.capacity() * sizeof(MidId);
+
+    return total;
+}
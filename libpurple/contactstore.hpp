@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "thrift_line/line_types.h"
+
+// Small integer handle for an interned MID. 0 is never a valid ID.
+typedef uint32_t MidId;
+
+// Interns MIDs into small integer IDs. MIDs are normally a type letter followed by 32 lowercase hex
+// digits, which are stored as 17 bytes. Anything else is stored as is.
+class MidTable {
+
+    static const MidId OTHER_BIT = 0x80000000;
+
+    typedef std::array<uint8_t, 17> Packed;
+
+    struct PackedHash {
+        size_t operator()(const Packed &p) const;
+    };
+
+    std::vector<Packed> packed;
+    std::unordered_map<Packed, MidId, PackedHash> packed_index;
+
+    std::vector<std::string> other;
+    std::unordered_map<std::string, MidId> other_index;
+
+public:
+
+    MidId intern(const std::string &mid);
+    MidId find(const std::string &mid) const;
+    std::string str(MidId id) const;
+
+    size_t size() const { return packed.size() + other.size(); }
+    size_t memory_usage() const;
+
+private:
+
+    static bool pack(const std::string &mid, Packed &p);
+
+};
+
+// The parts of a contact the plugin actually uses. Contacts are shared as immutable snapshots, and
+// an update replaces the snapshot instead of modifying it, so holders of a ContactPtr always see
+// consistent details.
+struct ContactInfo {
+    MidId mid;
+    line::ContactStatus::type status;
+    int32_t attributes;
+    std::string displayName;
+    std::string statusMessage;
+    std::string picturePath;
+};
+
+typedef std::shared_ptr<const ContactInfo> ContactPtr;
+
+struct GroupInfo {
+    MidId id;
+    std::string name;
+    MidId creator;
+    std::vector<MidId> members;
+    std::vector<MidId> invitee;
+};
+
+struct RoomInfo {
+    MidId id;
+    std::vector<MidId> contacts;
+};
+
+// Contacts, groups and rooms known to the plugin. Group and room members are stored as IDs that
+// refer to the contact table instead of as copies of the contacts.
+class ContactStore {
+
+    MidTable mids;
+
+    std::unordered_map<MidId, ContactPtr> contacts;
+    std::unordered_map<MidId, GroupInfo> groups;
+    std::unordered_map<MidId, RoomInfo> rooms;
+
+public:
+
+    MidId intern(const std::string &mid) { return mids.intern(mid); }
+    std::string mid(MidId id) const { return mids.str(id); }
+
+    ContactPtr get_contact(MidId id) const;
+    ContactPtr get_contact(const std::string &mid) const;
+    // Keeps the current snapshot if nothing has changed
+    ContactPtr update_contact(const line::Contact &contact);
+
+    const GroupInfo *get_group(const std::string &id) const;
+    // Group member contacts are only stored if the contact isn't known yet
+    const GroupInfo &update_group(const line::Group &group);
+
+    const RoomInfo *get_room(const std::string &mid) const;
+    // Room contacts are incomplete, so only their MIDs are stored
+    const RoomInfo &update_room(const line::Room &room);
+
+    // Approximate heap usage in bytes
+    size_t memory_usage() const;
+
+private:
+
+    MidId store_member(const line::Contact &contact);
+
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <unordered_set>
+
+// Remembers the most recently seen message IDs for filtering out duplicates. Only the last
+// `capacity` IDs are kept, the oldest are forgotten first.
+class DedupSet {
+
+    size_t capacity;
+
+    std::unordered_set<std::string> ids;
+
+    // Insertion order. Points into ids, as rehashing doesn't move elements.
+    std::deque<const std::string *> order;
+
+public:
+
+    DedupSet(size_t capacity) : capacity(capacity) { }
+
+    size_t size() const { return ids.size(); }
+
+    bool contains(const std::string &id) const {
+        return ids.count(id) != 0;
+    }
+
+    // Returns false if the ID was already in the set
+    bool insert(const std::string &id) {
+        auto r = ids.insert(id);
+        if (!r.second)
+            return false;
+
+        order.push_back(&*r.first);
+
+        while (order.size() > capacity) {
+            std::string oldest = *order.front();
+            order.pop_front();
+
+            ids.erase(oldest);
+        }
+
+        return true;
+    }
+
+};
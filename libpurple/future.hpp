@@ -0,0 +1,136 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Minimal futures for chaining RPCs on the main loop. A Future is resolved exactly once through its
+// Promise, and then() callbacks run when that happens, or right away if it already has. There is
+// no error channel: a failed RPC ends the connection instead of resolving its future.
+
+// Result type of calls that don't return anything
+struct Void { };
+
+template <typename T>
+class Promise;
+
+template <typename T>
+class Future {
+
+    friend class Promise<T>;
+
+    struct State {
+        bool ready;
+        T value;
+        std::vector<std::function<void(T &)>> callbacks;
+
+        State() : ready(false), value() { }
+    };
+
+    std::shared_ptr<State> state;
+
+    Future(std::shared_ptr<State> state) : state(state) { }
+
+public:
+
+    typedef T value_type;
+
+    bool ready() const { return state->ready; }
+
+    // Only valid once the future is ready
+    T &value() const { return state->value; }
+
+    void then(std::function<void(T &)> callback) const {
+        if (state->ready)
+            callback(state->value);
+        else
+            state->callbacks.push_back(callback);
+    }
+
+    // Chains a call that returns another future. The returned future resolves with the result of
+    // that one.
+    template <typename F>
+    auto and_then(F f) const -> decltype(f(std::declval<T &>())) {
+        typedef typename decltype(f(std::declval<T &>()))::value_type U;
+
+        Promise<U> promise;
+
+        then([f, promise](T &value) {
+            f(value).then([promise](U &result) {
+                promise.set_value(result);
+            });
+        });
+
+        return promise.future();
+    }
+
+};
+
+template <typename T>
+class Promise {
+
+    std::shared_ptr<typename Future<T>::State> state;
+
+public:
+
+    Promise() : state(std::make_shared<typename Future<T>::State>()) { }
+
+    Future<T> future() const { return Future<T>(state); }
+
+    void set_value(T value) const {
+        if (state->ready)
+            return;
+
+        state->value = std::move(value);
+        state->ready = true;
+
+        std::vector<std::function<void(T &)>> callbacks;
+        callbacks.swap(state->callbacks);
+
+        for (auto &callback: callbacks)
+            callback(state->value);
+    }
+
+};
+
+// Resolves once all of the futures have, with their values in the same order
+template <typename T>
+Future<std::vector<T>> all_of(const std::vector<Future<T>> &futures) {
+    Promise<std::vector<T>> promise;
+
+    if (futures.empty()) {
+        promise.set_value(std::vector<T>());
+        return promise.future();
+    }
+
+    auto values = std::make_shared<std::vector<T>>(futures.size());
+    auto remaining = std::make_shared<size_t>(futures.size());
+
+    for (size_t i = 0; i < futures.size(); i++) {
+        futures[i].then([promise, values, remaining, i](T &value) {
+            (*values)[i] = value;
+
+            if (--*remaining == 0)
+                promise.set_value(std::move(*values));
+        });
+    }
+
+    return promise.future();
+}
+
+// Resolves as soon as any of the futures does, with its index and value. Must be given at least
+// one future.
+template <typename T>
+Future<std::pair<size_t, T>> first_of(const std::vector<Future<T>> &futures) {
+    Promise<std::pair<size_t, T>> promise;
+
+    for (size_t i = 0; i < futures.size(); i++) {
+        futures[i].then([promise, i](T &value) {
+            // Later ones are ignored by set_value
+            promise.set_value(std::make_pair(i, value));
+        });
+    }
+
+    return promise.future();
+}
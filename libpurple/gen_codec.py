@@ -0,0 +1,271 @@
+#!/usr/bin/env python3
+#
+# Generates compact protocol codecs for the types and service functions in a Thrift file. Only the
+# subset of Thrift used by line.thrift is supported.
+#
+# Usage: gen_codec.py line.thrift > thrift_line/line_codec.hpp
+
+import re
+import sys
+
+BASE_TYPES = {
+    "bool": "bool",
+    "i32": "int32_t",
+    "i64": "int64_t",
+    "double": "double",
+    "string": "std::string",
+    "binary": "std::string",
+}
+
+BY_VALUE = set(["bool", "i32", "i64", "double"])
+
+
+class Field(object):
+    def __init__(self, fid, optional, ftype, name):
+        self.id = int(fid)
+        self.optional = bool(optional)
+        self.type = ftype.strip()
+        self.name = name
+
+
+def parse_fields(body):
+    return [Field(*m) for m in
+        re.findall(r"(-?\d+)\s*:\s*(optional\s+)?(\w+(?:\s*<[^>]*>)?)\s+(\w+)", body)]
+
+
+def parse(src):
+    src = re.sub(r"//[^\n]*", "", src)
+
+    enums = re.findall(r"\benum\s+(\w+)\s*\{", src)
+
+    structs = []
+    for m in re.finditer(r"\b(struct|exception)\s+(\w+)\s*\{([^}]*)\}", src):
+        structs.append((m.group(2), parse_fields(m.group(3))))
+
+    functions = []
+    service = re.search(r"\bservice\s+\w+\s*\{(.*)\}", src, re.S)
+    if service:
+        for m in re.finditer(
+            r"(\w+(?:\s*<[^>]*>)?)\s+(\w+)\s*\(([^)]*)\)\s*(?:throws\s*\(([^)]*)\))?\s*;",
+            service.group(1)):
+
+            functions.append((m.group(1).strip(), m.group(2), parse_fields(m.group(3)),
+                parse_fields(m.group(4) or "")))
+
+    return enums, structs, functions
+
+
+def cpp_type(t, enums):
+    t = t.strip()
+
+    if t in BASE_TYPES:
+        return BASE_TYPES[t]
+
+    m = re.match(r"list\s*<(.*)>$", t)
+    if m:
+        return "std::vector<%s>" % cpp_type(m.group(1), enums)
+
+    m = re.match(r"map\s*<\s*([\w<>]+)\s*,\s*([\w<>, ]+)>$", t)
+    if m:
+        return "std::map<%s, %s>" % (cpp_type(m.group(1), enums), cpp_type(m.group(2), enums))
+
+    if re.match(r"\w+$", t):
+        return ("line::%s::type" if t in enums else "line::%s") % t
+
+    raise ValueError("Unsupported type: " + t)
+
+
+def param(f, enums):
+    t = cpp_type(f.type, enums)
+
+    if f.type in BY_VALUE or f.type in enums:
+        return "%s %s" % (t, f.name)
+
+    return "const %s &%s" % (t, f.name)
+
+
+def gen_struct(out, name, fields, enums):
+    out.append("inline void Codec<line::%s>::read(CompactReader &r, line::%s &v) {" % (name, name))
+    out.append("    int16_t id;")
+    out.append("    int type;")
+    out.append("")
+    out.append("    r.read_struct_begin();")
+    out.append("")
+    out.append("    while (r.read_field(id, type)) {")
+    out.append("        switch (id) {")
+
+    for f in fields:
+        out.append("            case %d:" % f.id)
+        out.append("                if (read_field(r, type, v.%s))" % f.name)
+        out.append("                    v.__isset.%s = true;" % f.name)
+        out.append("                break;")
+
+    out.append("            default:")
+    out.append("                r.skip(type);")
+    out.append("                break;")
+    out.append("        }")
+    out.append("    }")
+    out.append("}")
+    out.append("")
+
+    out.append("inline void Codec<line::%s>::write(CompactWriter &w, const line::%s &v) {"
+        % (name, name))
+    out.append("    w.write_struct_begin();")
+
+    for f in fields:
+        if f.optional:
+            out.append("    if (v.__isset.%s)" % f.name)
+            out.append("        write_field(w, %d, v.%s);" % (f.id, f.name))
+        else:
+            out.append("    write_field(w, %d, v.%s);" % (f.id, f.name))
+
+    out.append("    w.write_struct_end();")
+    out.append("}")
+    out.append("")
+
+
+def gen_function(out, ret, name, args, throws, enums):
+    params = ["CompactWriter &w"] + [param(a, enums) for a in args]
+
+    out.append("inline void write_%s(%s) {" % (name, ", ".join(params)))
+    out.append("    w.write_message_begin(\"%s\", apache::thrift::protocol::T_CALL, 0);" % name)
+    out.append("    w.write_struct_begin();")
+
+    for a in args:
+        out.append("    write_field(w, %d, %s);" % (a.id, a.name))
+
+    out.append("    w.write_struct_end();")
+    out.append("}")
+    out.append("")
+
+    params = ["CompactReader &r"]
+    if ret != "void":
+        params.append("%s &success" % cpp_type(ret, enums))
+
+    out.append("inline void read_%s(%s) {" % (name, ", ".join(params)))
+    out.append("    read_reply_begin(r, \"%s\");" % name)
+    out.append("")
+
+    if ret != "void":
+        out.append("    bool has_success = false;")
+
+    for t in throws:
+        out.append("    %s %s;" % (cpp_type(t.type, enums), t.name))
+        out.append("    bool has_%s = false;" % t.name)
+
+    out.append("")
+    out.append("    int16_t id;")
+    out.append("    int type;")
+    out.append("")
+    out.append("    r.read_struct_begin();")
+    out.append("")
+    out.append("    while (r.read_field(id, type)) {")
+    out.append("        switch (id) {")
+
+    if ret != "void":
+        out.append("            case 0:")
+        out.append("                has_success = read_field(r, type, success);")
+        out.append("                break;")
+
+    for t in throws:
+        out.append("            case %d:" % t.id)
+        out.append("                has_%s = read_field(r, type, %s);" % (t.name, t.name))
+        out.append("                break;")
+
+    out.append("            default:")
+    out.append("                r.skip(type);")
+    out.append("                break;")
+    out.append("        }")
+    out.append("    }")
+
+    for t in throws:
+        out.append("")
+        out.append("    if (has_%s)" % t.name)
+        out.append("        throw %s;" % t.name)
+
+    if ret != "void":
+        out.append("")
+        out.append("    if (!has_success) {")
+        out.append("        throw apache::thrift::TApplicationException(")
+        out.append("            apache::thrift::TApplicationException::MISSING_RESULT,")
+        out.append("            \"%s failed: unknown result\");" % name)
+        out.append("    }")
+
+    out.append("}")
+    out.append("")
+
+
+def gen_async(out, ret, name, args, enums):
+    params = ["Client &client"] + [param(a, enums) for a in args]
+    result = cpp_type(ret, enums) if ret != "void" else "Void"
+
+    out.append("template <typename Client>")
+    out.append("inline Future<%s> %s(%s) {" % (result, name, ", ".join(params)))
+    out.append("    std::string request;")
+    out.append("    CompactWriter w(request);")
+    out.append("    write_%s(%s);" % (name, ", ".join(["w"] + [a.name for a in args])))
+    out.append("")
+    out.append("    return client.template call<%s>(std::move(request)," % result)
+
+    if ret != "void":
+        out.append("        [](CompactReader &r, %s &result) { read_%s(r, result); });"
+            % (result, name))
+    else:
+        out.append("        [](CompactReader &r, Void &) { read_%s(r); });" % name)
+
+    out.append("}")
+    out.append("")
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write("Usage: %s file.thrift\n" % sys.argv[0])
+        sys.exit(1)
+
+    with open(sys.argv[1]) as f:
+        enums, structs, functions = parse(f.read())
+
+    out = [
+        "// Generated from %s by gen_codec.py. Do not edit." % sys.argv[1],
+        "",
+        "#pragma once",
+        "",
+        "#include \"line_types.h\"",
+        "",
+        "#include \"../codec.hpp\"",
+        "#include \"../future.hpp\"",
+        "",
+        "namespace line_codec {",
+        "",
+    ]
+
+    # Declare all codecs first so that they can refer to each other regardless of order
+    for name, fields in structs:
+        out.append("template <>")
+        out.append("struct Codec<line::%s> {" % name)
+        out.append("    static const int TYPE = CompactReader::STRUCT;")
+        out.append("")
+        out.append("    static bool is(int type) { return type == TYPE; }")
+        out.append("")
+        out.append("    static void read(CompactReader &r, line::%s &v);" % name)
+        out.append("    static void write(CompactWriter &w, const line::%s &v);" % name)
+        out.append("};")
+        out.append("")
+
+    for name, fields in structs:
+        gen_struct(out, name, fields, enums)
+
+    for ret, name, args, throws in functions:
+        gen_function(out, ret, name, args, throws, enums)
+
+    # Typed calls that return a future, for ThriftClient::call
+    for ret, name, args, throws in functions:
+        gen_async(out, ret, name, args, enums)
+
+    out.append("}")
+
+    sys.stdout.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
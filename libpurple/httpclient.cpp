@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <sstream>
 #include <string.h>
 
@@ -8,7 +9,11 @@
 
 HTTPClient::HTTPClient(PurpleAccount *acct) :
     acct(acct),
-    in_flight(0)
+    in_flight(0),
+    stats(nullptr)
+#ifdef LINE_NETWORK_THREAD
+    , net([this](NetRequest *nreq) { net_done(nreq); })
+#endif
 {
 }
 
@@ -17,6 +22,15 @@ HTTPClient::~HTTPClient() {
         if (r->handle)
             purple_util_fetch_url_cancel(r->handle);
     }
+
+#ifdef LINE_NETWORK_THREAD
+    for (Request *r: net_requests)
+        delete r;
+#endif
+}
+
+void HTTPClient::set_stats(Stats *stats) {
+    this->stats = stats;
 }
 
 void HTTPClient::request(std::string url, HTTPClient::CompleteFunc callback) {
@@ -37,8 +51,28 @@ void HTTPClient::request(std::string url, HTTPFlag flags,
     req->content_type = content_type;
     req->body = body;
     req->flags = flags;
+    req->callback = [callback](int status, Headers &, const guchar *data, gsize len) {
+        callback(status, data, len);
+    };
+    req->handle = nullptr;
+    req->queue_time = g_get_monotonic_time();
+
+    request_queue.push_back(req);
+
+    execute_next();
+}
+
+void HTTPClient::request(std::string url, HTTPFlag flags, HTTPClient::Headers headers,
+    HTTPClient::HeadersCompleteFunc callback)
+{
+    Request *req = new Request();
+    req->client = this;
+    req->url = url;
+    req->headers = headers;
+    req->flags = flags;
     req->callback = callback;
     req->handle = nullptr;
+    req->queue_time = g_get_monotonic_time();
 
     request_queue.push_back(req);
 
@@ -57,12 +91,35 @@ void HTTPClient::execute_next() {
 
         purple_url_parse(req->url.c_str(), &host, &port, &path, nullptr, nullptr);
 
+        req->host = host;
+        req->start_time = g_get_monotonic_time();
+
+        if (stats)
+            stats->add("http_queue_us", req->start_time - req->queue_time);
+
+#ifdef LINE_NETWORK_THREAD
+        // The network thread reads the raw response until the connection closes, so ask for a
+        // response without chunked encoding. Unlike libpurple it doesn't follow redirects either.
+        const char *version = "HTTP/1.0";
+#else
+        const char *version = "HTTP/1.1";
+#endif
+
         ss
-            << (req->body.size() ? "POST" : "GET") << " /" << path << " HTTP/1.1" "\r\n"
+            << (req->body.size() ? "POST" : "GET") << " /" << path << " " << version << "\r\n"
             << "Connection: close\r\n"
             << "Host: " << host << ":" << port << "\r\n"
             << "User-Agent: " << LINE_USER_AGENT << "\r\n";
 
+#ifdef LINE_NETWORK_THREAD
+        NetRequest *nreq = new NetRequest();
+        nreq->host = host;
+        nreq->port = port;
+        nreq->tls = (req->url.compare(0, 8, "https://") == 0);
+        nreq->max_len = (req->flags & HTTPFlag::LARGE) ? (100 * 1024 * 1024) : (512 * 1024);
+        nreq->tag = (void *)req;
+#endif
+
         free(host);
         free(path);
 
@@ -76,6 +133,9 @@ void HTTPClient::execute_next() {
         if (req->content_type.size())
             ss << "Content-Type: " << req->content_type << "\r\n";
 
+        for (auto &h: req->headers)
+            ss << h.first << ": " << h.second << "\r\n";
+
         if (req->body.size())
             ss << "Content-Length: " << req->body.size() << "\r\n";
 
@@ -85,6 +145,23 @@ void HTTPClient::execute_next() {
 
         in_flight++;
 
+        if (stats)
+            stats->count("http_bytes_out", (uint64_t)ss.tellp());
+
+#ifdef LINE_NETWORK_THREAD
+        nreq->data = ss.str();
+
+        if (!net.submit(nreq)) {
+            // Can't happen as long as MAX_IN_FLIGHT is below the queue size
+            delete nreq;
+            complete(req, nullptr, 0, "Network thread queue is full");
+        } else {
+            net_requests.insert(req);
+        }
+
+        continue;
+#endif
+
         req->handle = purple_util_fetch_url_request_len_with_account(
             acct,
             req->url.c_str(),
@@ -102,9 +179,20 @@ void HTTPClient::execute_next() {
 void HTTPClient::complete(HTTPClient::Request *req,
     const gchar *url_text, gsize len, const gchar *error_message)
 {
+    Headers headers;
+
+    if (stats) {
+        stats->add("http_us " + req->host, g_get_monotonic_time() - req->start_time);
+
+        if (!url_text || error_message)
+            stats->count("http_errors");
+        else
+            stats->count("http_bytes_in", len);
+    }
+
     if (!url_text || error_message) {
         purple_debug_error("util", "HTTP error: %s\n", error_message);
-        req->callback(-1, nullptr, 0);
+        req->callback(-1, headers, nullptr, 0);
     } else {
         int status = 0;
         const guchar *body = nullptr;
@@ -122,11 +210,30 @@ void HTTPClient::complete(HTTPClient::Request *req,
 
             ss >> status;
 
+            std::stringstream hs(std::string(status_end + 2, header_end - status_end - 2));
+            std::string line;
+
+            while (std::getline(hs, line)) {
+                size_t colon = line.find(':');
+                if (colon == std::string::npos)
+                    continue;
+
+                std::string name = line.substr(0, colon);
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+                size_t value_start = line.find_first_not_of(" \t", colon + 1);
+                size_t value_end = line.find_last_not_of(" \t\r");
+
+                headers[name] = (value_start == std::string::npos || value_end < value_start)
+                    ? ""
+                    : line.substr(value_start, value_end - value_start + 1);
+            }
+
             body = (const guchar *)(header_end + 4);
             body_len = len - (header_end - url_text + 4);
         }
 
-        req->callback(status, body, body_len);
+        req->callback(status, headers, body, body_len);
     }
 
     request_queue.remove(req);
@@ -144,3 +251,20 @@ void HTTPClient::purple_cb(PurpleUtilFetchUrlData *url_data, gpointer user_data,
 
     req->client->complete(req, url_text, len, error_message);
 }
+
+#ifdef LINE_NETWORK_THREAD
+
+void HTTPClient::net_done(NetRequest *nreq) {
+    Request *req = (Request *)nreq->tag;
+
+    net_requests.erase(req);
+
+    complete(req,
+        nreq->response.c_str(),
+        nreq->response.size(),
+        nreq->error.size() ? nreq->error.c_str() : nullptr);
+
+    delete nreq;
+}
+
+#endif
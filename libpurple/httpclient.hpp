@@ -3,10 +3,15 @@
 #include <string>
 #include <functional>
 #include <list>
+#include <map>
+#include <set>
 
 #include <account.h>
 #include <util.h>
 
+#include "netthread.hpp"
+#include "stats.hpp"
+
 enum class HTTPFlag {
     NONE =  0,
     AUTH =  1 << 0,
@@ -24,16 +29,28 @@ inline constexpr bool operator&(HTTPFlag a, HTTPFlag b) {
 class HTTPClient {
     const int MAX_IN_FLIGHT = 4;
 
+public:
+
+    using Headers = std::map<std::string, std::string>;
+
+private:
+
     using CompleteFunc = std::function<void(int, const guchar *, gsize)>;
+    using HeadersCompleteFunc = std::function<void(int, Headers &, const guchar *, gsize)>;
 
     struct Request {
         HTTPClient *client;
         std::string url;
         std::string content_type;
         std::string body;
+        Headers headers;
         HTTPFlag flags;
-        CompleteFunc callback;
+        HeadersCompleteFunc callback;
         PurpleUtilFetchUrlData *handle;
+
+        std::string host;
+        gint64 queue_time;
+        gint64 start_time;
     };
 
     PurpleAccount *acct;
@@ -41,21 +58,44 @@ class HTTPClient {
     std::list<Request *> request_queue;
     int in_flight;
 
+    Stats *stats;
+
+#ifdef LINE_NETWORK_THREAD
+    // Requests handed to the network thread. Freed by the destructor if they're still pending,
+    // as the thread drops their responses when it's stopped.
+    std::set<Request *> net_requests;
+
+    // Declared last so that the thread is stopped before anything else is torn down
+    NetThread net;
+#endif
+
     void execute_next();
     void complete(Request *req, const gchar *url_text, gsize len, const gchar *error_message);
 
     static void purple_cb(PurpleUtilFetchUrlData *url_data, gpointer user_data,
         const gchar *url_text, gsize len, const gchar *error_message);
 
+#ifdef LINE_NETWORK_THREAD
+    void net_done(NetRequest *nreq);
+#endif
+
 public:
 
     HTTPClient(PurpleAccount *acct);
     ~HTTPClient();
 
+    // Records latencies and traffic into stats, which must outlive the client
+    void set_stats(Stats *stats);
+
     void request(std::string url, CompleteFunc callback);
     void request(std::string url, HTTPFlag flags, CompleteFunc callback);
     void request(std::string url, HTTPFlag flags,
         std::string content_type, std::string body,
         CompleteFunc callback);
 
+    // Sends extra request headers and passes the response headers to the callback. Response
+    // header names are lowercased.
+    void request(std::string url, HTTPFlag flags, Headers headers,
+        HeadersCompleteFunc callback);
+
 };
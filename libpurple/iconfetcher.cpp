@@ -0,0 +1,147 @@
+#include <time.h>
+
+#include <blist.h>
+#include <buddyicon.h>
+#include <conversation.h>
+#include <debug.h>
+
+#include "constants.hpp"
+#include "iconfetcher.hpp"
+
+IconFetcher::IconFetcher(PurpleAccount *acct, HTTPClient &http) :
+    acct(acct),
+    http(http),
+    in_flight(0)
+{
+}
+
+void IconFetcher::fetch(std::string uid, std::string pic_path) {
+    PurpleBuddy *buddy = purple_find_buddy(acct, uid.c_str());
+    if (!buddy)
+        return;
+
+    if (has_icon(buddy, pic_path)) {
+        int checked = purple_blist_node_get_int(PURPLE_BLIST_NODE(buddy), "line-icon-checked");
+
+        if (time(nullptr) - checked < REVALIDATE_INTERVAL)
+            return;
+    }
+
+    bool queued = (pending.count(uid) != 0);
+
+    pending[uid] = pic_path;
+
+    if (!queued) {
+        if (purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, uid.c_str(), acct))
+            queue.push_front(uid);
+        else
+            queue.push_back(uid);
+    }
+
+    execute_next();
+}
+
+void IconFetcher::prioritize(std::string uid) {
+    if (!pending.count(uid))
+        return;
+
+    for (auto i = queue.begin(); i != queue.end(); i++) {
+        if (*i == uid) {
+            queue.erase(i);
+            queue.push_front(uid);
+            break;
+        }
+    }
+}
+
+void IconFetcher::execute_next() {
+    while (in_flight < MAX_IN_FLIGHT && !queue.empty()) {
+        std::string uid = queue.front();
+        queue.pop_front();
+
+        auto i = pending.find(uid);
+        if (i == pending.end())
+            continue;
+
+        std::string pic_path = i->second;
+        pending.erase(i);
+
+        PurpleBuddy *buddy = purple_find_buddy(acct, uid.c_str());
+        if (!buddy)
+            continue;
+
+        HTTPClient::Headers headers;
+
+        if (has_icon(buddy, pic_path)) {
+            PurpleBlistNode *node = PURPLE_BLIST_NODE(buddy);
+
+            const char *etag = purple_blist_node_get_string(node, "line-icon-etag");
+            if (etag)
+                headers["If-None-Match"] = etag;
+
+            const char *last_modified = purple_blist_node_get_string(node,
+                "line-icon-last-modified");
+            if (last_modified)
+                headers["If-Modified-Since"] = last_modified;
+        }
+
+        in_flight++;
+
+        http.request(LINE_OS_URL + pic_path, HTTPFlag::AUTH, headers,
+            [this, uid, pic_path]
+            (int status, HTTPClient::Headers &headers, const guchar *data, gsize len)
+        {
+            complete(uid, pic_path, status, headers, data, len);
+        });
+    }
+}
+
+void IconFetcher::complete(std::string uid, std::string pic_path,
+    int status, HTTPClient::Headers &headers, const guchar *data, gsize len)
+{
+    in_flight--;
+
+    PurpleBuddy *buddy = purple_find_buddy(acct, uid.c_str());
+
+    if (buddy) {
+        PurpleBlistNode *node = PURPLE_BLIST_NODE(buddy);
+
+        if (status == 304) {
+            purple_blist_node_set_int(node, "line-icon-checked", (int)time(nullptr));
+        } else if (status == 200 && data) {
+            purple_buddy_icons_set_for_user(
+                acct,
+                uid.c_str(),
+                g_memdup(data, len),
+                len,
+                pic_path.c_str());
+
+            if (headers.count("etag"))
+                purple_blist_node_set_string(node, "line-icon-etag", headers["etag"].c_str());
+            else
+                purple_blist_node_remove_setting(node, "line-icon-etag");
+
+            if (headers.count("last-modified")) {
+                purple_blist_node_set_string(node, "line-icon-last-modified",
+                    headers["last-modified"].c_str());
+            } else {
+                purple_blist_node_remove_setting(node, "line-icon-last-modified");
+            }
+
+            purple_blist_node_set_int(node, "line-icon-checked", (int)time(nullptr));
+        } else {
+            purple_debug_warning("line", "Couldn't download icon for %s. Status: %d\n",
+                uid.c_str(), status);
+        }
+    }
+
+    execute_next();
+}
+
+// Whether the buddy's current icon is the one for pic_path, which means it can be revalidated
+// instead of downloaded again
+bool IconFetcher::has_icon(PurpleBuddy *buddy, std::string &pic_path) {
+    const char *checksum = purple_buddy_icons_get_checksum_for_user(buddy);
+
+    return checksum && pic_path == checksum && purple_buddy_get_icon(buddy);
+}
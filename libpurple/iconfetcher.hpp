@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <map>
+
+#include <account.h>
+
+#include "httpclient.hpp"
+
+// Fetches buddy icons in the background. Only a few icons are fetched at a time so that they don't
+// hold up stickers and previews in the HTTP client, and contacts with an open conversation go
+// first. Icons that have been fetched before are revalidated with conditional requests.
+class IconFetcher {
+
+    static const int MAX_IN_FLIGHT = 2;
+
+    // How often an unchanged icon is checked for changes
+    static const int REVALIDATE_INTERVAL = 24 * 60 * 60;
+
+    PurpleAccount *acct;
+    HTTPClient &http;
+
+    // uid -> picture path
+    std::map<std::string, std::string> pending;
+    std::deque<std::string> queue;
+    int in_flight;
+
+public:
+
+    IconFetcher(PurpleAccount *acct, HTTPClient &http);
+
+    // Queues an icon fetch unless the buddy already has an up-to-date icon for pic_path
+    void fetch(std::string uid, std::string pic_path);
+
+    // Moves a queued fetch to the front of the queue
+    void prioritize(std::string uid);
+
+private:
+
+    void execute_next();
+    void complete(std::string uid, std::string pic_path,
+        int status, HTTPClient::Headers &headers, const guchar *data, gsize len);
+
+    bool has_icon(PurpleBuddy *buddy, std::string &pic_path);
+
+};
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <string>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "imagescaler.hpp"
+
+ImageScaler::ImageScaler(int max_size, int quality) :
+    max_size(max_size > 0 ? max_size : G_MAXINT),
+    quality(std::min(std::max(quality, 1), 100))
+{
+}
+
+bool ImageScaler::scale(const guchar *data, gsize len, gchar **out, gsize *out_len) {
+    GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
+
+    if (!gdk_pixbuf_loader_write(loader, data, len, nullptr)
+        || !gdk_pixbuf_loader_close(loader, nullptr))
+    {
+        g_object_unref(loader);
+        return false;
+    }
+
+    // Only the first frame of an animation would survive, so animations are sent as is
+    GdkPixbufAnimation *animation = gdk_pixbuf_loader_get_animation(loader);
+    if (animation && !gdk_pixbuf_animation_is_static_image(animation)) {
+        g_object_unref(loader);
+        return false;
+    }
+
+    GdkPixbufFormat *format = gdk_pixbuf_loader_get_format(loader);
+    gchar *format_name = format ? gdk_pixbuf_format_get_name(format) : nullptr;
+    bool is_jpeg = format_name && std::string(format_name) == "jpeg";
+    g_free(format_name);
+
+    GdkPixbuf *pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+    if (!pixbuf) {
+        g_object_unref(loader);
+        return false;
+    }
+
+    // Photos from phones are often rotated by an EXIF tag only
+    pixbuf = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+
+    g_object_unref(loader);
+
+    int width = gdk_pixbuf_get_width(pixbuf),
+        height = gdk_pixbuf_get_height(pixbuf);
+
+    if (is_jpeg && width <= max_size && height <= max_size) {
+        g_object_unref(pixbuf);
+        return false;
+    }
+
+    if (width > max_size || height > max_size) {
+        double factor = (double)max_size / std::max(width, height);
+
+        width = std::max(1, (int)(width * factor));
+        height = std::max(1, (int)(height * factor));
+    }
+
+    // Scale and flatten any transparency onto white in one go, as JPEG has no alpha channel
+    GdkPixbuf *scaled = gdk_pixbuf_composite_color_simple(
+        pixbuf, width, height, GDK_INTERP_BILINEAR, 255, 8, 0xffffff, 0xffffff);
+
+    g_object_unref(pixbuf);
+
+    if (!scaled)
+        return false;
+
+    std::string quality_str = std::to_string(quality);
+
+    gboolean saved = gdk_pixbuf_save_to_buffer(
+        scaled, out, out_len, "jpeg", nullptr, "quality", quality_str.c_str(), nullptr);
+
+    g_object_unref(scaled);
+
+    if (!saved)
+        return false;
+
+    if (*out_len >= len) {
+        g_free(*out);
+        return false;
+    }
+
+    return true;
+}
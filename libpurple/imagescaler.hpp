@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+#include <glib.h>
+
+// Downscales and recompresses images before they are uploaded. This is run on a worker thread, so
+// it must not use libpurple.
+class ImageScaler {
+
+    int max_size;
+    int quality;
+
+public:
+
+    // A max_size of 0 or less means no limit. quality is clamped to 1-100.
+    ImageScaler(int max_size, int quality);
+
+    // Decodes the image and, if it's larger than max_size in either dimension or not a JPEG,
+    // encodes it as a JPEG that fits within max_size. Returns false if the original image should
+    // be sent as is, either because it's already good, because it's animated or because the
+    // result wouldn't be smaller. On success *out must be freed with g_free.
+    bool scale(const guchar *data, gsize len, gchar **out, gsize *out_len);
+
+};
@@ -1,12 +1,19 @@
+#include <algorithm>
 #include <sstream>
 #include <limits>
+#include <exception>
+#include <memory>
+
+#include <string.h>
 
 #include <debug.h>
 
+#include <thrift/protocol/TProtocolException.h>
 #include <thrift/transport/TTransportException.h>
 
 #include "thrift_line/TalkService.h"
 
+#include "compactreader.hpp"
 #include "constants.hpp"
 #include "linehttptransport.hpp"
 
@@ -22,13 +29,20 @@ LineHttpTransport::LineHttpTransport(
     port(port),
     ls_mode(ls_mode),
     state(ConnectionState::DISCONNECTED),
+    stats(nullptr),
     auto_reconnect(false),
     reconnect_timeout_handle(0),
     reconnect_timeout(0),
     ssl(NULL),
     input_handle(0),
     connection_id(0),
+    request_part(0),
     request_written(0),
+    request_bytes_written(0),
+    request_bytes_total(0),
+    request_send_time(0),
+    response_pos(0),
+    decoder(1),
     keep_alive(false),
     status_code_(0),
     content_length_(0)
@@ -44,6 +58,14 @@ void LineHttpTransport::set_auto_reconnect(bool auto_reconnect) {
         this->auto_reconnect = auto_reconnect;
 }
 
+void LineHttpTransport::set_stats(Stats *stats) {
+    this->stats = stats;
+}
+
+void LineHttpTransport::set_error_callback(std::function<void()> error_callback) {
+    this->error_callback = error_callback;
+}
+
 int LineHttpTransport::status_code() {
     return status_code_;
 }
@@ -52,6 +74,18 @@ int LineHttpTransport::content_length() {
     return content_length_;
 }
 
+const std::string &LineHttpTransport::response() {
+    return response_body;
+}
+
+size_t LineHttpTransport::bytes_written() {
+    return request_bytes_written;
+}
+
+size_t LineHttpTransport::bytes_total() {
+    return request_bytes_total;
+}
+
 void LineHttpTransport::open() {
     if (state != ConnectionState::DISCONNECTED)
         return;
@@ -81,9 +115,25 @@ void LineHttpTransport::ssl_error(PurpleSslConnection *, PurpleSslErrorType err)
 
     ssl = nullptr;
 
+    if (error_callback) {
+        fail();
+        return;
+    }
+
     purple_connection_ssl_error(conn, err);
 }
 
+// Drops the queued requests after a connection failure and lets the owner handle it
+void LineHttpTransport::fail() {
+    close();
+
+    request_queue = std::queue<Request>();
+    in_progress = false;
+    status_code_ = -1;
+
+    error_callback();
+}
+
 void LineHttpTransport::close() {
     if (state == ConnectionState::DISCONNECTED)
         return;
@@ -100,7 +150,8 @@ void LineHttpTransport::close() {
         input_handle = 0;
     }
 
-    purple_ssl_close(ssl);
+    if (ssl)
+        purple_ssl_close(ssl);
     ssl = NULL;
     connection_id++;
 
@@ -109,11 +160,20 @@ void LineHttpTransport::close() {
     request_buf.str("");
 
     response_str = "";
-    response_buf.str("");
+    response_body = "";
+    response_pos = 0;
+
+    request_bytes_written = 0;
+    request_bytes_total = 0;
 }
 
 uint32_t LineHttpTransport::read_virt(uint8_t *buf, uint32_t len) {
-    return (uint32_t )response_buf.sgetn((char *)buf, len);
+    size_t count = std::min((size_t)len, response_body.size() - response_pos);
+
+    memcpy(buf, response_body.data() + response_pos, count);
+    response_pos += count;
+
+    return (uint32_t)count;
 }
 
 void LineHttpTransport::write_virt(const uint8_t *buf, uint32_t len) {
@@ -121,17 +181,45 @@ void LineHttpTransport::write_virt(const uint8_t *buf, uint32_t len) {
 }
 
 void LineHttpTransport::request(std::string method, std::string path, std::string content_type,
-    std::function<void()> callback)
+    std::function<void()> callback, DecodeFunc decode)
+{
+    std::vector<BodyPart> body;
+    body.emplace_back(request_buf.str());
+
+    request_buf.str("");
+
+    request(method, path, content_type, std::move(body), callback, decode);
+}
+
+void LineHttpTransport::request(std::string method, std::string path, std::string content_type,
+    std::vector<BodyPart> body, std::function<void()> callback, DecodeFunc decode)
 {
     Request req;
     req.method = method;
     req.path = path;
     req.content_type = content_type;
-    req.body = request_buf.str();
+    req.body = std::move(body);
     req.callback = callback;
-    request_queue.push(req);
+    req.decode = decode;
+    req.queue_time = g_get_monotonic_time();
+
+    if (stats && content_type == "application/x-thrift" && !req.body.empty()) {
+        // Peek the method name from the message header for per method latencies
+        const BodyPart &part = req.body.front();
+        CompactReader r((const uint8_t *)part.data(), part.size());
+
+        try {
+            BufferView name;
+            int32_t seqid;
+
+            r.read_message_begin(name, seqid);
+            req.rpc = name.str();
+        } catch (...) {
+            // Not worth failing the request over
+        }
+    }
 
-    request_buf.str("");
+    request_queue.push(std::move(req));
 
     send_next();
 }
@@ -171,17 +259,28 @@ void LineHttpTransport::send_next() {
             data << "X-Line-Access: " << auth_token << "\r\n";
     }
 
+    size_t content_length = 0;
+    for (BodyPart &part: next_req.body)
+        content_length += part.size();
+
     if (next_req.method == "POST")
-        data << "Content-Length: " << next_req.body.size() << "\r\n";
+        data << "Content-Length: " << content_length << "\r\n";
 
-    data
-        << "\r\n"
-        << next_req.body;
+    data << "\r\n";
+
+    // The body parts are written straight from their buffers after the headers
 
     request_data = data.str();
+    request_part = 0;
     request_written = 0;
+    request_bytes_written = 0;
+    request_bytes_total = request_data.size() + content_length;
+    request_send_time = g_get_monotonic_time();
     in_progress = true;
 
+    if (stats)
+        stats->add("thrift_queue_us", request_send_time - next_req.queue_time);
+
     input_handle = purple_input_add(ssl->fd, PURPLE_INPUT_WRITE,
         WRAPPER(LineHttpTransport::ssl_write), (gpointer)this);
     ssl_write(ssl->fd, PURPLE_INPUT_WRITE);
@@ -197,16 +296,41 @@ int LineHttpTransport::reconnect_timeout_cb() {
     return FALSE;
 }
 
-void LineHttpTransport::write_request() {
-    if (request_written < request_data.size()) {
-        size_t r = purple_ssl_write(ssl,
-            request_data.c_str() + request_written, request_data.size() - request_written);
+// Writes as much of the current request as the connection will take. Returns true when the whole
+// request has been written.
+bool LineHttpTransport::write_request() {
+    std::vector<BodyPart> &body = request_queue.front().body;
+
+    while (request_part <= body.size()) {
+        const char *data = request_data.c_str();
+        size_t size = request_data.size();
+
+        if (request_part > 0) {
+            data = body[request_part - 1].data();
+            size = body[request_part - 1].size();
+        }
+
+        if (request_written < size) {
+            size_t r = purple_ssl_write(ssl, data + request_written, size - request_written);
+
+            if (r == 0 || r == (size_t)-1)
+                return false;
+
+            request_written += r;
+            request_bytes_written += r;
+
+            purple_debug_info("line", "Wrote: %d, %d out of %d!\n",
+                (int)r, (int)request_written, (int)size);
 
-        request_written += r;
+            if (request_written < size)
+                return false;
+        }
 
-        purple_debug_info("line", "Wrote: %d, %d out of %d!\n",
-            (int)r, (int)request_written, (int)request_data.size());
+        request_part++;
+        request_written = 0;
     }
+
+    return true;
 }
 
 void LineHttpTransport::ssl_write(gint, PurpleInputCondition) {
@@ -219,12 +343,10 @@ void LineHttpTransport::ssl_write(gint, PurpleInputCondition) {
         return;
     }
 
-    if (request_written < request_data.size()) {
-        request_written += purple_ssl_write(ssl,
-            request_data.c_str() + request_written, request_data.size() - request_written);
-    }
+    if (write_request()) {
+        if (stats)
+            stats->count("thrift_bytes_out", request_bytes_total);
 
-    if (request_written >= request_data.size()) {
         purple_input_remove(input_handle);
 
         input_handle = purple_input_add(ssl->fd, PURPLE_INPUT_READ,
@@ -253,10 +375,15 @@ void LineHttpTransport::ssl_read(gint, PurpleInputCondition) {
             close();
 
             if (in_progress) {
-                if (auto_reconnect) {
+                if (error_callback) {
+                    fail();
+                } else if (auto_reconnect) {
                     purple_debug_info("line", "Reconnecting in %ds...\n",
                         reconnect_timeout);
 
+                    if (stats)
+                        stats->count("thrift_reconnects");
+
                     state = ConnectionState::RECONNECTING;
 
                     purple_timeout_add_seconds(
@@ -276,6 +403,9 @@ void LineHttpTransport::ssl_read(gint, PurpleInputCondition) {
 
         any = true;
 
+        if (stats)
+            stats->count("thrift_bytes_in", count);
+
         response_str.append((const char *)buf, count);
 
         if (content_length_ < 0)
@@ -285,7 +415,9 @@ void LineHttpTransport::ssl_read(gint, PurpleInputCondition) {
             purple_input_remove(input_handle);
             input_handle = 0;
 
-            if (status_code_ == 403) {
+            record_response();
+
+            if (status_code_ == 403 && !error_callback) {
                 // Don't try to reconnect because this usually means the user has logged in from
                 // elsewhere.
 
@@ -296,64 +428,162 @@ void LineHttpTransport::ssl_read(gint, PurpleInputCondition) {
                 return;
             }
 
-            response_buf.str(response_str.substr(0, content_length_));
-            response_str.erase(0, content_length_);
+            if (request_queue.front().decode) {
+                decode_response();
+                return;
+            }
 
-            int connection_id_before = connection_id;
+            take_body(response_body);
+            response_pos = 0;
+
+            if (!finish_request(request_queue.front().callback))
+                break;
+        }
+    }
+}
+
+// Hands the response body to the decoder and finishes the request on the main loop once it's
+// decoded. The connection sits idle meanwhile, as the next request isn't sent until then.
+void LineHttpTransport::decode_response() {
+    auto body = std::make_shared<std::string>();
+    take_body(*body);
+
+    DecodeFunc decode = request_queue.front().decode;
+    int status = status_code_;
+    auto error = std::make_shared<std::exception_ptr>();
+    auto decode_time = std::make_shared<gint64>(0);
+
+    int connection_id_before = connection_id;
+
+    decoder.run(
+        [decode, status, body, error, decode_time]() {
+            gint64 start = g_get_monotonic_time();
 
             try {
-                request_queue.front().callback();
-            } catch (line::TalkException &err) {
-                std::string msg = "LINE: TalkException: ";
-                msg += err.reason;
+                decode(status, *body);
+            } catch (...) {
+                *error = std::current_exception();
+            }
 
-                if (err.code == line::ErrorCode::NOT_AUTHORIZED_DEVICE) {
-                    purple_account_remove_setting(acct, LINE_ACCOUNT_AUTH_TOKEN);
+            *decode_time = g_get_monotonic_time() - start;
+        },
+        [this, error, decode_time, connection_id_before]() {
+            if (connection_id != connection_id_before || request_queue.empty())
+                return; // Connection was closed while decoding
 
-                    if (err.reason == "AUTHENTICATION_DIVESTED_BY_OTHER_DEVICE") {
-                        msg = "LINE: You have been logged out because "
-                            "you logged in from another device.";
-                    } else if (err.reason == "REVOKE") {
-                        msg = "LINE: This device was logged out via the mobile app.";
-                    }
+            if (stats)
+                stats->add("thrift_decode_us", *decode_time);
 
-                    // Don't try to reconnect so we don't fight over the session with another client
+            std::function<void()> callback = request_queue.front().callback;
 
-                    conn->wants_to_die = TRUE;
-                }
+            // Errors from decoding are handled as if they had happened in the callback
+            finish_request([callback, error]() {
+                if (*error)
+                    std::rethrow_exception(*error);
 
-                purple_connection_error(conn, msg.c_str());
-                return;
-            } catch (apache::thrift::TApplicationException &err) {
-                std::string msg = "LINE: Application error: ";
-                msg += err.what();
+                callback();
+            });
+        });
+}
 
-                purple_connection_error(conn, msg.c_str());
-                return;
-            } catch (apache::thrift::transport::TTransportException &err) {
-                std::string msg = "LINE: Transport error: ";
-                msg += err.what();
+// Moves the body of the current response into body without copying it. Anything received after
+// it is kept in response_str.
+void LineHttpTransport::take_body(std::string &body) {
+    std::string rest = response_str.substr(content_length_);
+    response_str.resize(content_length_);
 
-                purple_connection_error(conn, msg.c_str());
-                return;
-            }
+    body.swap(response_str);
+    response_str = std::move(rest);
+}
 
-            request_queue.pop();
+// Runs the callback for the current request and moves on to the next one. Returns false if the
+// connection was closed and shouldn't be read from anymore.
+bool LineHttpTransport::finish_request(std::function<void()> callback) {
+    int connection_id_before = connection_id;
 
-            in_progress = false;
+    gint64 start = g_get_monotonic_time();
 
-            if (connection_id != connection_id_before)
-                break; // Callback closed connection, don't try to continue reading
+    try {
+        callback();
+    } catch (line::TalkException &err) {
+        std::string msg = "LINE: TalkException: ";
+        msg += err.reason;
 
-            if (!keep_alive) {
-                close();
-                send_next();
-                break;
+        if (err.code == line::ErrorCode::NOT_AUTHORIZED_DEVICE) {
+            purple_account_remove_setting(acct, LINE_ACCOUNT_AUTH_TOKEN);
+
+            if (err.reason == "AUTHENTICATION_DIVESTED_BY_OTHER_DEVICE") {
+                msg = "LINE: You have been logged out because "
+                    "you logged in from another device.";
+            } else if (err.reason == "REVOKE") {
+                msg = "LINE: This device was logged out via the mobile app.";
             }
 
-            send_next();
+            // Don't try to reconnect so we don't fight over the session with another client
+
+            conn->wants_to_die = TRUE;
         }
+
+        purple_connection_error(conn, msg.c_str());
+        return false;
+    } catch (apache::thrift::TApplicationException &err) {
+        std::string msg = "LINE: Application error: ";
+        msg += err.what();
+
+        purple_connection_error(conn, msg.c_str());
+        return false;
+    } catch (apache::thrift::transport::TTransportException &err) {
+        std::string msg = "LINE: Transport error: ";
+        msg += err.what();
+
+        purple_connection_error(conn, msg.c_str());
+        return false;
+    } catch (apache::thrift::protocol::TProtocolException &err) {
+        std::string msg = "LINE: Protocol error: ";
+        msg += err.what();
+
+        purple_connection_error(conn, msg.c_str());
+        return false;
+    }
+
+    // Time the main loop was blocked handling the response, decoding included unless it was done
+    // in the background
+    if (stats)
+        stats->add("thrift_callback_us", g_get_monotonic_time() - start);
+
+    request_queue.pop();
+
+    in_progress = false;
+    request_bytes_written = 0;
+    request_bytes_total = 0;
+
+    if (connection_id != connection_id_before)
+        return false; // Callback closed connection, don't try to continue reading
+
+    if (!keep_alive) {
+        close();
+        send_next();
+        return false;
     }
+
+    send_next();
+
+    return true;
+}
+
+// Records the time from sending the current request until its response was fully received. Long
+// poll requests include the time spent waiting for operations.
+void LineHttpTransport::record_response() {
+    if (!stats)
+        return;
+
+    Request &req = request_queue.front();
+    gint64 latency = g_get_monotonic_time() - request_send_time;
+
+    stats->add("path_us " + req.path, latency);
+
+    if (!req.rpc.empty())
+        stats->add("rpc_us " + req.rpc, latency);
 }
 
 void LineHttpTransport::try_parse_response_header() {
@@ -4,6 +4,8 @@
 #include <string>
 #include <sstream>
 #include <queue>
+#include <memory>
+#include <vector>
 
 #include <stdint.h>
 
@@ -12,10 +14,44 @@
 
 #include <thrift/transport/TTransport.h>
 
+#include "stats.hpp"
 #include "wrapper.hpp"
+#include "workerpool.hpp"
 
 class LineHttpTransport : public apache::thrift::transport::TTransport {
 
+public:
+
+    // Decodes a response body on a worker thread. Must not touch libpurple, nor the transport, so
+    // the status code is read on the main loop and passed in.
+    typedef std::function<void(int status, std::string &body)> DecodeFunc;
+
+    // A piece of a request body. A part either owns its data, or refers to a buffer owned by
+    // somebody else which is kept alive by keep_alive until the request is done with it. The latter
+    // makes it possible to send large buffers without copying them.
+    class BodyPart {
+        std::string owned;
+        const char *ptr;
+        size_t len;
+        std::shared_ptr<const void> keep_alive;
+
+    public:
+        BodyPart(std::string data)
+            : owned(std::move(data)), ptr(nullptr), len(0)
+        {
+        }
+
+        BodyPart(const void *ptr, size_t len, std::shared_ptr<const void> keep_alive)
+            : ptr((const char *)ptr), len(len), keep_alive(keep_alive)
+        {
+        }
+
+        const char *data() const { return ptr ? ptr : owned.data(); }
+        size_t size() const { return ptr ? len : owned.size(); }
+    };
+
+private:
+
     enum class ConnectionState {
         DISCONNECTED = 0,
         CONNECTED = 1,
@@ -27,8 +63,13 @@ class LineHttpTransport : public apache::thrift::transport::TTransport {
         std::string method;
         std::string path;
         std::string content_type;
-        std::string body;
+        std::vector<BodyPart> body;
         std::function<void()> callback;
+        DecodeFunc decode;
+
+        // Thrift method name for stats, if known
+        std::string rpc;
+        gint64 queue_time;
     };
 
     static const size_t BUFFER_SIZE = 4096;
@@ -43,7 +84,10 @@ class LineHttpTransport : public apache::thrift::transport::TTransport {
 
     ConnectionState state;
 
+    Stats *stats;
+
     bool auto_reconnect;
+    std::function<void()> error_callback;
     guint reconnect_timeout_handle;
     int reconnect_timeout;
 
@@ -55,15 +99,29 @@ class LineHttpTransport : public apache::thrift::transport::TTransport {
 
     std::stringbuf request_buf;
 
+    // Part of the current request being written, 0 being the headers in request_data and the
+    // rest being body parts
+    size_t request_part;
     size_t request_written;
     std::string request_data;
 
+    size_t request_bytes_written;
+    size_t request_bytes_total;
+    gint64 request_send_time;
+
     bool in_progress;
     std::string response_str;
-    std::stringbuf response_buf;
+
+    // Body of the response being handled, and how much of it has been read
+    std::string response_body;
+    size_t response_pos;
 
     std::queue<Request> request_queue;
 
+    // Decodes response bodies for requests that have a decode function. The current request isn't
+    // finished until its callback has run, so responses are still handled in order.
+    WorkerPool decoder;
+
     bool keep_alive;
     int status_code_;
     int content_length_;
@@ -77,6 +135,13 @@ public:
 
     void set_auto_reconnect(bool auto_reconnect);
 
+    // Makes connection failures drop the queued requests and call error_callback instead of
+    // disconnecting the account. status_code() is -1 when it runs.
+    void set_error_callback(std::function<void()> error_callback);
+
+    // Records latencies and traffic into stats, which must outlive the transport
+    void set_stats(Stats *stats);
+
     virtual void open();
     virtual void close();
 
@@ -84,25 +149,43 @@ public:
     void write_virt(const uint8_t *buf, uint32_t len);
 
     void request(std::string method, std::string path, std::string content_type,
-        std::function<void()> callback);
+        std::function<void()> callback, DecodeFunc decode=DecodeFunc());
+    void request(std::string method, std::string path, std::string content_type,
+        std::vector<BodyPart> body, std::function<void()> callback,
+        DecodeFunc decode=DecodeFunc());
     int status_code();
     int content_length();
 
+    // Body of the response whose callback is running
+    const std::string &response();
+
+    // Progress of the request currently being sent, headers included
+    size_t bytes_written();
+    size_t bytes_total();
+
     //virtual const uin8_t* borrow_virt(uint8_t *buf, uint32_t *len);
     //virtual void consume_virt(uint32_t len);
 
 private:
 
-    void write_request();
+    bool write_request();
 
     void ssl_connect(PurpleSslConnection *, PurpleInputCondition);
     void ssl_error(PurpleSslConnection *, PurpleSslErrorType err);
     void ssl_write(int, PurpleInputCondition);
     void ssl_read(int, PurpleInputCondition);
 
+    void fail();
+
     int reconnect_timeout_cb();
 
     void send_next();
 
+    void take_body(std::string &body);
+    void decode_response();
+    bool finish_request(std::function<void()> callback);
+
     void try_parse_response_header();
+
+    void record_response();
 };
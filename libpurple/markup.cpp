@@ -0,0 +1,165 @@
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "markup.hpp"
+
+static const char replacement_char[] = "\xef\xbf\xbd";
+
+// Whether an ASCII byte needs escaping or replacing
+static inline bool is_special_ascii(unsigned char c) {
+    return c == '\0' || c == '&' || c == '<' || c == '>' || c == '"';
+}
+
+// Decodes one UTF-8 sequence. Returns its length, or 0 if it's invalid.
+static inline int decode_utf8(const unsigned char *p, const unsigned char *end, uint32_t *cp) {
+    unsigned char c = p[0];
+    int len;
+    uint32_t min;
+
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    } else if (c >= 0xc2 && c <= 0xdf) {
+        len = 2;
+        min = 0x80;
+        *cp = c & 0x1f;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        len = 3;
+        min = 0x800;
+        *cp = c & 0x0f;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        len = 4;
+        min = 0x10000;
+        *cp = c & 0x07;
+    } else {
+        return 0;
+    }
+
+    if (end - p < len)
+        return 0;
+
+    for (int i = 1; i < len; i++) {
+        if ((p[i] & 0xc0) != 0x80)
+            return 0;
+
+        *cp = (*cp << 6) | (p[i] & 0x3f);
+    }
+
+    // Overlong forms, surrogates and out of range code points
+    if (*cp < min || (*cp >= 0xd800 && *cp <= 0xdfff) || *cp > 0x10ffff)
+        return 0;
+
+    return len;
+}
+
+// Escapes one character. Returns the number of input bytes consumed.
+static inline size_t escape_one(std::string &out, const unsigned char *p, const unsigned char *end) {
+    switch (*p) {
+        case '&': out.append("&amp;", 5); return 1;
+        case '<': out.append("&lt;", 4); return 1;
+        case '>': out.append("&gt;", 4); return 1;
+        case '"': out.append("&quot;", 6); return 1;
+        case '\0': out.append(replacement_char, 3); return 1;
+    }
+
+    uint32_t cp;
+    int len = decode_utf8(p, end, &cp);
+
+    if (len == 0) {
+        out.append(replacement_char, 3);
+        return 1;
+    }
+
+    out.append((const char *)p, len);
+
+    return len;
+}
+
+// Returns the end of the run of characters starting at p that can be copied as is
+static inline const unsigned char *skip_plain(const unsigned char *p, const unsigned char *end) {
+#ifdef __SSE2__
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8('"');
+#endif
+
+    for (;;) {
+#ifdef __SSE2__
+        // Skip 16 bytes of plain ASCII at a time, and stop at the first byte that is special or
+        // not ASCII
+        while (end - p >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+            // Signed comparison, so bytes >= 0x80 count as less than one along with NUL
+            __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmplt_epi8(v, one), _mm_cmpeq_epi8(v, amp)),
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(v, lt),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, gt), _mm_cmpeq_epi8(v, quot))));
+
+            unsigned mask = (unsigned)_mm_movemask_epi8(special);
+
+            if (mask != 0) {
+                p += __builtin_ctz(mask);
+                break;
+            }
+
+            p += 16;
+        }
+#endif
+
+        if (p >= end)
+            return p;
+
+        if (*p < 0x80) {
+            if (is_special_ascii(*p))
+                return p;
+
+            p++;
+            continue;
+        }
+
+        // Stay on this path through runs of non-ASCII text such as CJK, as the vector loop would
+        // stop at every character anyway
+        while (p < end && *p >= 0x80) {
+            uint32_t cp;
+            int len = decode_utf8(p, end, &cp);
+
+            if (len == 0)
+                return p;
+
+            p += len;
+        }
+    }
+}
+
+void markup_escape_append(std::string &out, const char *text, size_t len) {
+    const unsigned char *p = (const unsigned char *)text, *end = p + len;
+
+    // Most messages need little or no escaping
+    out.reserve(out.size() + len + len / 8);
+
+    while (p < end) {
+        const unsigned char *start = p;
+
+        p = skip_plain(p, end);
+
+        out.append((const char *)start, p - start);
+
+        if (p < end)
+            p += escape_one(out, p, end);
+    }
+}
+
+std::string markup_escape(std::string const &text) {
+    std::string result;
+
+    markup_escape_append(result, text.data(), text.size());
+
+    return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+
+// Appends text to out escaped for use in Pidgin markup. Escapes the same characters as
+// purple_markup_escape_text, and replaces invalid UTF-8 and NUL bytes with U+FFFD so that
+// malformed text from the server never reaches the UI.
+void markup_escape_append(std::string &out, const char *text, size_t len);
+
+std::string markup_escape(std::string const &text);
+
+// Builds message markup in a single buffer
+class MarkupBuilder {
+
+    std::string buf;
+
+public:
+
+    MarkupBuilder(size_t reserve=128) {
+        buf.reserve(reserve);
+    }
+
+    // Appends markup as is
+    MarkupBuilder &raw(const char *markup) {
+        buf.append(markup);
+        return *this;
+    }
+
+    MarkupBuilder &raw(const std::string &markup) {
+        buf.append(markup);
+        return *this;
+    }
+
+    // Appends plain text, escaped
+    MarkupBuilder &text(const std::string &text) {
+        markup_escape_append(buf, text.data(), text.size());
+        return *this;
+    }
+
+    MarkupBuilder &number(long long n) {
+        buf.append(std::to_string(n));
+        return *this;
+    }
+
+    std::string &str() { return buf; }
+
+};
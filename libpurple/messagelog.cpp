@@ -0,0 +1,391 @@
+#include <unistd.h>
+
+#include <boost/make_shared.hpp>
+
+#include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
+
+#include <glib/gstdio.h>
+
+#include <debug.h>
+
+#include "messagelog.hpp"
+
+using apache::thrift::protocol::TCompactProtocol;
+using apache::thrift::transport::TMemoryBuffer;
+
+enum RecordType {
+    RECORD_MESSAGE = 1,
+    RECORD_LINK = 2,
+};
+
+static const size_t RECORD_HEADER_SIZE = 5;
+
+static void put_le(std::string &buf, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        buf.push_back((char)((v >> (i * 8)) & 0xff));
+}
+
+static uint64_t get_le(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+
+    for (int i = bytes - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+
+    return v;
+}
+
+MessageLog::MessageLog() {
+}
+
+void MessageLog::open(std::string dir) {
+    this->dir = dir;
+
+    boxes.clear();
+}
+
+int64_t MessageLog::message_seq(const line::Message &msg) {
+    auto i = msg.contentMetadata.find("seq");
+    if (i == msg.contentMetadata.end())
+        return UNKNOWN;
+
+    try {
+        int64_t seq = std::stoll(i->second);
+        return (seq >= 0) ? seq : UNKNOWN;
+    } catch (...) {
+        return UNKNOWN;
+    }
+}
+
+bool MessageLog::valid_box(const std::string &box) {
+    if (box.empty())
+        return false;
+
+    for (char c: box) {
+        if (!g_ascii_isalnum(c))
+            return false;
+    }
+
+    return true;
+}
+
+std::string MessageLog::path(const std::string &box) {
+    return dir + G_DIR_SEPARATOR_S + box + ".log";
+}
+
+MessageLog::Box *MessageLog::get_box(const std::string &box) {
+    if (dir.empty() || !valid_box(box))
+        return nullptr;
+
+    Box &b = boxes[box];
+
+    if (!b.loaded) {
+        b.loaded = true;
+        b.live_tail = UNKNOWN;
+
+        load(box, b);
+    }
+
+    return &b;
+}
+
+void MessageLog::load(const std::string &box, Box &b) {
+    std::string file_path = path(box);
+
+    FILE *f = g_fopen(file_path.c_str(), "rb");
+    if (!f)
+        return;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    long good_end = 0;
+
+    while (true) {
+        unsigned char header[RECORD_HEADER_SIZE];
+        if (fread(header, 1, RECORD_HEADER_SIZE, f) != RECORD_HEADER_SIZE)
+            break;
+
+        uint32_t len = (uint32_t)get_le(header + 1, 4);
+
+        unsigned char fields[18];
+        if (len < 16 || fread(fields, 1, 16, f) != 16)
+            break;
+
+        int64_t seq = (int64_t)get_le(fields, 8), prev = (int64_t)get_le(fields + 8, 8);
+
+        if (header[0] == RECORD_MESSAGE) {
+            if (len < 18 || fread(fields + 16, 1, 2, f) != 2)
+                break;
+
+            uint32_t id_len = (uint32_t)get_le(fields + 16, 2);
+            if (len < 18 + id_len)
+                break;
+
+            std::string id(id_len, '\0');
+            if (id_len && fread(&id[0], 1, id_len, f) != id_len)
+                break;
+
+            long offset = ftell(f);
+            uint32_t msg_len = len - 18 - id_len;
+
+            if (fseek(f, msg_len, SEEK_CUR) != 0)
+                break;
+
+            b.by_seq[seq] = Entry { offset, msg_len, prev };
+            b.by_id[id] = seq;
+        } else if (header[0] == RECORD_LINK) {
+            auto i = b.by_seq.find(seq);
+            if (i != b.by_seq.end())
+                i->second.prev = prev;
+
+            if (len > 16 && fseek(f, len - 16, SEEK_CUR) != 0)
+                break;
+        } else {
+            break;
+        }
+
+        // fseek past the end succeeds, so make sure the record was all there
+        long pos = ftell(f);
+        if (pos > size)
+            break;
+
+        good_end = pos;
+    }
+
+    fclose(f);
+
+    // Drop whatever was left of a record that was being written when we last quit, so that new
+    // records don't end up after it
+    if (size > good_end) {
+        purple_debug_warning("line", "Truncating message log %s at %ld of %ld bytes\n",
+            box.c_str(), good_end, size);
+
+        if (truncate(file_path.c_str(), good_end) != 0)
+            purple_debug_warning("line", "Couldn't truncate message log %s\n", box.c_str());
+    }
+}
+
+void MessageLog::store(const std::string &box, Box &b, const line::Message &msg, int64_t seq,
+    int64_t prev)
+{
+    std::string data;
+
+    try {
+        boost::shared_ptr<TMemoryBuffer> buf = boost::make_shared<TMemoryBuffer>();
+        TCompactProtocol proto(buf);
+
+        msg.write(&proto);
+
+        data = buf->getBufferAsString();
+    } catch (apache::thrift::TException &err) {
+        purple_debug_warning("line", "Couldn't serialize message %s: %s\n",
+            msg.id.c_str(), err.what());
+        return;
+    }
+
+    std::string record;
+    record.reserve(RECORD_HEADER_SIZE + 18 + msg.id.size() + data.size());
+
+    record.push_back((char)RECORD_MESSAGE);
+    put_le(record, 18 + msg.id.size() + data.size(), 4);
+    put_le(record, (uint64_t)seq, 8);
+    put_le(record, (uint64_t)prev, 8);
+    put_le(record, msg.id.size(), 2);
+    record.append(msg.id);
+
+    FILE *f = g_fopen(path(box).c_str(), "ab");
+    if (!f)
+        return;
+
+    fseek(f, 0, SEEK_END);
+    long offset = ftell(f) + (long)record.size();
+
+    record.append(data);
+
+    bool ok = (fwrite(record.data(), 1, record.size(), f) == record.size());
+
+    if (fclose(f) != 0 || !ok) {
+        purple_debug_warning("line", "Couldn't write message log %s\n", box.c_str());
+        return;
+    }
+
+    b.by_seq[seq] = Entry { offset, (uint32_t)data.size(), prev };
+    b.by_id[msg.id] = seq;
+}
+
+void MessageLog::link(const std::string &box, Box &b, int64_t seq, int64_t prev) {
+    auto i = b.by_seq.find(seq);
+    if (i == b.by_seq.end() || i->second.prev == prev)
+        return;
+
+    std::string record;
+
+    record.push_back((char)RECORD_LINK);
+    put_le(record, 16, 4);
+    put_le(record, (uint64_t)seq, 8);
+    put_le(record, (uint64_t)prev, 8);
+
+    FILE *f = g_fopen(path(box).c_str(), "ab");
+    if (!f)
+        return;
+
+    bool ok = (fwrite(record.data(), 1, record.size(), f) == record.size());
+
+    if (fclose(f) != 0 || !ok) {
+        purple_debug_warning("line", "Couldn't write message log %s\n", box.c_str());
+        return;
+    }
+
+    i->second.prev = prev;
+}
+
+void MessageLog::append_live(const std::string &box, const line::Message &msg) {
+    Box *b = get_box(box);
+    if (!b || msg.id.empty() || b->by_id.count(msg.id))
+        return;
+
+    int64_t seq = message_seq(msg);
+    if (seq == UNKNOWN || b->by_seq.count(seq))
+        return;
+
+    store(box, *b, msg, seq, b->live_tail);
+
+    b->live_tail = seq;
+}
+
+void MessageLog::add_history(const std::string &box, int64_t end_seq,
+    const std::vector<line::Message> &newest_first, bool at_start)
+{
+    Box *b = get_box(box);
+    if (!b)
+        return;
+
+    for (size_t i = 0; i < newest_first.size(); i++) {
+        const line::Message &msg = newest_first[i];
+
+        int64_t seq = message_seq(msg);
+        if (seq == UNKNOWN || msg.id.empty())
+            continue;
+
+        // The message before this one, if the server says so
+        int64_t prev = UNKNOWN;
+        if (i + 1 < newest_first.size())
+            prev = message_seq(newest_first[i + 1]);
+        else if (at_start)
+            prev = START;
+
+        if (b->by_seq.count(seq)) {
+            if (prev != UNKNOWN)
+                link(box, *b, seq, prev);
+        } else {
+            store(box, *b, msg, seq, prev);
+        }
+
+        // The page continues right before end_seq
+        if (i == 0 && end_seq != UNKNOWN)
+            link(box, *b, end_seq, seq);
+    }
+
+    if (newest_first.empty() && at_start && end_seq != UNKNOWN)
+        link(box, *b, end_seq, START);
+
+    if (end_seq == UNKNOWN && b->live_tail == UNKNOWN && !newest_first.empty())
+        b->live_tail = message_seq(newest_first.front());
+}
+
+bool MessageLog::read_entry(FILE *f, const std::string &box, const Entry &e, line::Message &msg) {
+    std::string data(e.len, '\0');
+
+    if (fseek(f, e.offset, SEEK_SET) != 0
+        || (data.size() && fread(&data[0], 1, data.size(), f) != data.size()))
+    {
+        return false;
+    }
+
+    try {
+        boost::shared_ptr<TMemoryBuffer> buf = boost::make_shared<TMemoryBuffer>(
+            (uint8_t *)&data[0], (uint32_t)data.size());
+        TCompactProtocol proto(buf);
+
+        msg.read(&proto);
+    } catch (apache::thrift::TException &err) {
+        purple_debug_warning("line", "Couldn't read message log %s: %s\n",
+            box.c_str(), err.what());
+        return false;
+    }
+
+    return true;
+}
+
+bool MessageLog::get(const std::string &box, int64_t seq, line::Message &msg) {
+    Box *b = get_box(box);
+    if (!b)
+        return false;
+
+    auto i = b->by_seq.find(seq);
+    if (i == b->by_seq.end())
+        return false;
+
+    FILE *f = g_fopen(path(box).c_str(), "rb");
+    if (!f)
+        return false;
+
+    bool ok = read_entry(f, box, i->second, msg);
+
+    fclose(f);
+
+    return ok;
+}
+
+bool MessageLog::previous(const std::string &box, int64_t end_seq, int count,
+    std::vector<line::Message> &out)
+{
+    Box *b = get_box(box);
+    if (!b)
+        return false;
+
+    auto i = b->by_seq.find(end_seq);
+    if (i == b->by_seq.end())
+        return false;
+
+    int64_t seq = i->second.prev;
+
+    if (seq == UNKNOWN || count <= 0)
+        return false;
+
+    if (seq == START)
+        return true;
+
+    FILE *f = g_fopen(path(box).c_str(), "rb");
+    if (!f)
+        return false;
+
+    bool at_start = false;
+
+    while ((int)out.size() < count) {
+        auto j = b->by_seq.find(seq);
+        if (j == b->by_seq.end())
+            break;
+
+        line::Message msg;
+        if (!read_entry(f, box, j->second, msg))
+            break;
+
+        out.push_back(msg);
+
+        seq = j->second.prev;
+
+        if (seq == START) {
+            at_start = true;
+            break;
+        } else if (seq == UNKNOWN) {
+            break;
+        }
+    }
+
+    fclose(f);
+
+    return at_start;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "thrift_line/line_types.h"
+
+// Append-only on-disk log of messages for each message box, used to serve history without asking
+// the server. Each stored message remembers the seq of the message that comes right before it in
+// the box, if that is known, so history can be read backwards from the log until the first gap.
+//
+// Each box is a file of records:
+//   type (1 byte), payload length (4 bytes), payload
+// Message payload:
+//   seq (8 bytes), previous seq (8 bytes), ID length (2 bytes), ID, message in Thrift compact form
+// Link payload, which sets the previous seq of a message stored earlier:
+//   seq (8 bytes), previous seq (8 bytes)
+// Integers are little-endian. The seq index of a box is built by scanning its file the first time
+// the box is used.
+class MessageLog {
+
+    // Previous seq values that aren't seqs
+    static const int64_t UNKNOWN = -1;
+    static const int64_t START = -2; // first message of the box
+
+    struct Entry {
+        long offset; // of the Thrift data
+        uint32_t len;
+        int64_t prev;
+    };
+
+    struct Box {
+        bool loaded;
+        std::map<int64_t, Entry> by_seq;
+        std::unordered_map<std::string, int64_t> by_id;
+
+        // Latest message received while logged in, which new messages follow directly
+        int64_t live_tail;
+    };
+
+    std::string dir;
+
+    std::unordered_map<std::string, Box> boxes;
+
+public:
+
+    MessageLog();
+
+    void open(std::string dir);
+
+    // Stores a new message from the live message stream
+    void append_live(const std::string &box, const line::Message &msg);
+
+    // Stores a page of history from the server, newest first. end_seq is the seq of the message
+    // right after the page, or -1 if the page is the most recent messages. at_start means there is
+    // no history before the page.
+    void add_history(const std::string &box, int64_t end_seq,
+        const std::vector<line::Message> &newest_first, bool at_start);
+
+    // Reads up to count messages right before end_seq, newest first. Stops at the first gap.
+    // Returns true if the start of the history was reached.
+    bool previous(const std::string &box, int64_t end_seq, int count,
+        std::vector<line::Message> &out);
+
+    // Reads a single stored message
+    bool get(const std::string &box, int64_t seq, line::Message &msg);
+
+    static int64_t message_seq(const line::Message &msg);
+
+private:
+
+    static bool valid_box(const std::string &box);
+
+    std::string path(const std::string &box);
+    Box *get_box(const std::string &box);
+    void load(const std::string &box, Box &b);
+
+    bool read_entry(FILE *f, const std::string &box, const Entry &e, line::Message &msg);
+
+    void store(const std::string &box, Box &b, const line::Message &msg, int64_t seq,
+        int64_t prev);
+    void link(const std::string &box, Box &b, int64_t seq, int64_t prev);
+
+};
@@ -0,0 +1,57 @@
+#include "messagering.hpp"
+
+#include <algorithm>
+
+MessageRing::MessageRing(size_t capacity) : capacity(capacity) { }
+
+std::string MessageRing::box_id(const line::Message &msg, const std::string &self_mid) {
+    if (msg.toType == line::MIDType::USER && msg.from_ != self_mid)
+        return msg.from_;
+
+    return msg.to;
+}
+
+void MessageRing::push(const std::string &box, const line::Message &msg) {
+    if (msg.id.empty())
+        return;
+
+    std::deque<line::Message> &ring = boxes[box];
+
+    // Duplicates can only be recent, so look from the back
+    for (auto i = ring.rbegin(); i != ring.rend(); i++) {
+        if (i->id == msg.id)
+            return;
+    }
+
+    ring.push_back(msg);
+
+    while (ring.size() > capacity)
+        ring.pop_front();
+}
+
+void MessageRing::reset(const std::string &box, const std::vector<line::Message> &newest_first) {
+    std::deque<line::Message> &ring = boxes[box];
+
+    ring.clear();
+
+    size_t n = std::min(newest_first.size(), capacity);
+
+    for (size_t i = n; i > 0; i--) {
+        if (!newest_first[i - 1].id.empty())
+            ring.push_back(newest_first[i - 1]);
+    }
+}
+
+bool MessageRing::recent(const std::string &box, size_t count, std::vector<line::Message> &out)
+    const
+{
+    auto i = boxes.find(box);
+    if (i == boxes.end() || i->second.size() < count || count == 0)
+        return false;
+
+    const std::deque<line::Message> &ring = i->second;
+
+    out.assign(ring.end() - count, ring.end());
+
+    return true;
+}
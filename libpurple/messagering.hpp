@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+
+#include "thrift_line/line_types.h"
+
+// Keeps the most recent messages of each message box seen since login, so that a newly opened
+// conversation can show recent history without asking the server. Each box holds at most
+// `capacity` messages. As long as every message in a box since login has been pushed, the box is
+// an unbroken tail of its history.
+class MessageRing {
+
+    size_t capacity;
+
+    // Oldest first
+    std::unordered_map<std::string, std::deque<line::Message>> boxes;
+
+public:
+
+    MessageRing(size_t capacity);
+
+    // The message box a message belongs to. This is the conversation name, i.e. the other user for
+    // IMs and the group or room ID for chats.
+    static std::string box_id(const line::Message &msg, const std::string &self_mid);
+
+    // Appends a new message to its box. Messages without an ID and ones already in the box are
+    // ignored.
+    void push(const std::string &box, const line::Message &msg);
+
+    // Replaces the contents of a box with the most recent messages from the server, newest first
+    void reset(const std::string &box, const std::vector<line::Message> &newest_first);
+
+    // Copies the newest `count` messages of a box into out, oldest first. Returns false if the box
+    // doesn't have that many messages.
+    bool recent(const std::string &box, size_t count, std::vector<line::Message> &out) const;
+
+};
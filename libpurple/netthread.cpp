@@ -0,0 +1,254 @@
+#ifdef LINE_NETWORK_THREAD
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "netthread.hpp"
+
+// Requests are handed between threads through the queues, and the NetThread they belong to is the
+// only other thing the callbacks need
+struct NetOp {
+    NetThread *net;
+    NetRequest *req;
+};
+
+NetThread::NetThread(std::function<void(NetRequest *)> done) :
+    done(done),
+    stopping(false),
+    active(0)
+{
+    to_net_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    to_main_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    context = g_main_context_new();
+    loop = g_main_loop_new(context, FALSE);
+    cancellable = g_cancellable_new();
+
+    GIOChannel *channel = g_io_channel_unix_new(to_net_fd);
+    GSource *source = g_io_create_watch(channel, G_IO_IN);
+    g_source_set_callback(source, (GSourceFunc)net_wake_cb, (gpointer)this, nullptr);
+    g_source_attach(source, context);
+    g_source_unref(source);
+    g_io_channel_unref(channel);
+
+    input_handle = purple_input_add(to_main_fd, PURPLE_INPUT_READ, main_wake_cb, (gpointer)this);
+
+    thread = g_thread_new("line-net", thread_main, (gpointer)this);
+}
+
+NetThread::~NetThread() {
+    // The thread cancels whatever is in progress and exits once it has all been cleaned up
+    stopping = true;
+    wake(to_net_fd);
+
+    g_thread_join(thread);
+
+    purple_input_remove(input_handle);
+
+    while (NetRequest *req = requests.pop())
+        delete req;
+
+    while (NetRequest *req = responses.pop())
+        delete req;
+
+    close(to_net_fd);
+    close(to_main_fd);
+
+    g_object_unref(cancellable);
+    g_main_loop_unref(loop);
+    g_main_context_unref(context);
+}
+
+bool NetThread::submit(NetRequest *req) {
+    req->conn = nullptr;
+    req->written = 0;
+
+    if (!requests.push(req))
+        return false;
+
+    wake(to_net_fd);
+
+    return true;
+}
+
+void NetThread::wake(int fd) {
+    uint64_t one = 1;
+
+    // Only fails if the counter is about to overflow, in which case the other side is going to
+    // wake up anyway
+    ssize_t r = write(fd, &one, sizeof(one));
+    (void)r;
+}
+
+void NetThread::drain(int fd) {
+    uint64_t count;
+
+    while (read(fd, &count, sizeof(count)) == sizeof(count))
+        ;
+}
+
+void NetThread::main_wake_cb(gpointer data, gint, PurpleInputCondition) {
+    NetThread *net = (NetThread *)data;
+
+    drain(net->to_main_fd);
+
+    while (NetRequest *req = net->responses.pop())
+        net->done(req);
+}
+
+gpointer NetThread::thread_main(gpointer data) {
+    NetThread *net = (NetThread *)data;
+
+    g_main_context_push_thread_default(net->context);
+    g_main_loop_run(net->loop);
+    g_main_context_pop_thread_default(net->context);
+
+    return nullptr;
+}
+
+gboolean NetThread::net_wake_cb(GIOChannel *, GIOCondition, gpointer data) {
+    NetThread *net = (NetThread *)data;
+
+    drain(net->to_net_fd);
+
+    if (net->stopping) {
+        g_cancellable_cancel(net->cancellable);
+        net->maybe_quit();
+
+        return TRUE;
+    }
+
+    while (NetRequest *req = net->requests.pop())
+        net->start(req);
+
+    return TRUE;
+}
+
+void NetThread::maybe_quit() {
+    if (stopping && active == 0)
+        g_main_loop_quit(loop);
+}
+
+void NetThread::start(NetRequest *req) {
+    active++;
+
+    GSocketClient *client = g_socket_client_new();
+    g_socket_client_set_tls(client, req->tls ? TRUE : FALSE);
+
+    g_socket_client_connect_to_host_async(
+        client,
+        req->host.c_str(),
+        (guint16)req->port,
+        cancellable,
+        connect_cb,
+        (gpointer)new NetOp { this, req });
+
+    g_object_unref(client);
+}
+
+void NetThread::connect_cb(GObject *source, GAsyncResult *res, gpointer data) {
+    NetOp *op = (NetOp *)data;
+
+    GError *err = nullptr;
+
+    op->req->conn = g_socket_client_connect_to_host_finish(G_SOCKET_CLIENT(source), res, &err);
+
+    if (!op->req->conn)
+        op->net->finish(op->req, err);
+    else
+        op->net->write_next(op->req);
+
+    delete op;
+}
+
+void NetThread::write_next(NetRequest *req) {
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(req->conn));
+
+    g_output_stream_write_async(
+        out,
+        req->data.data() + req->written,
+        req->data.size() - req->written,
+        G_PRIORITY_DEFAULT,
+        cancellable,
+        write_cb,
+        (gpointer)new NetOp { this, req });
+}
+
+void NetThread::write_cb(GObject *source, GAsyncResult *res, gpointer data) {
+    NetOp *op = (NetOp *)data;
+
+    GError *err = nullptr;
+
+    gssize n = g_output_stream_write_finish(G_OUTPUT_STREAM(source), res, &err);
+
+    if (n < 0) {
+        op->net->finish(op->req, err);
+    } else {
+        op->req->written += n;
+
+        if (op->req->written < op->req->data.size())
+            op->net->write_next(op->req);
+        else
+            op->net->read_next(op->req);
+    }
+
+    delete op;
+}
+
+void NetThread::read_next(NetRequest *req) {
+    GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(req->conn));
+
+    g_input_stream_read_async(
+        in,
+        req->buf,
+        sizeof(req->buf),
+        G_PRIORITY_DEFAULT,
+        cancellable,
+        read_cb,
+        (gpointer)new NetOp { this, req });
+}
+
+void NetThread::read_cb(GObject *source, GAsyncResult *res, gpointer data) {
+    NetOp *op = (NetOp *)data;
+    NetRequest *req = op->req;
+
+    GError *err = nullptr;
+
+    gssize n = g_input_stream_read_finish(G_INPUT_STREAM(source), res, &err);
+
+    if (n < 0) {
+        op->net->finish(req, err);
+    } else if (n == 0) {
+        op->net->finish(req, nullptr);
+    } else if (req->response.size() + n > req->max_len) {
+        req->error = "Response is too large";
+        op->net->finish(req, nullptr);
+    } else {
+        req->response.append(req->buf, n);
+        op->net->read_next(req);
+    }
+
+    delete op;
+}
+
+void NetThread::finish(NetRequest *req, GError *err) {
+    if (err) {
+        req->error = err->message;
+        g_error_free(err);
+    }
+
+    if (req->conn) {
+        g_object_unref(req->conn);
+        req->conn = nullptr;
+    }
+
+    active--;
+
+    // Can't be full, as there are never more requests in flight than the queue holds
+    responses.push(req);
+    wake(to_main_fd);
+
+    maybe_quit();
+}
+
+#endif
@@ -0,0 +1,97 @@
+#pragma once
+
+#ifdef LINE_NETWORK_THREAD
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include <gio/gio.h>
+
+#include <eventloop.h>
+
+#include "spscqueue.hpp"
+
+// A complete HTTP exchange done by the network thread. The request is sent as is and the response
+// is read until the server closes the connection, so it must ask for HTTP/1.0 to avoid chunked
+// responses. Redirects aren't followed and proxies aren't used.
+struct NetRequest {
+    std::string host;
+    int port;
+    bool tls;
+    std::string data;
+    size_t max_len;
+
+    void *tag;
+
+    // Filled in by the network thread
+    std::string response;
+    std::string error;
+
+    // Network thread state
+    GSocketConnection *conn;
+    size_t written;
+    char buf[16 * 1024];
+};
+
+// Runs HTTP requests on a thread of its own, so that TLS and socket I/O for large downloads don't
+// compete with the UI on the main loop. Requests and responses are passed as complete buffers over
+// lock-free queues, and each side wakes the other with an eventfd.
+class NetThread {
+
+    static const size_t QUEUE_SIZE = 64;
+
+    std::function<void(NetRequest *)> done;
+
+    SpscQueue<NetRequest, QUEUE_SIZE> requests;
+    SpscQueue<NetRequest, QUEUE_SIZE> responses;
+
+    int to_net_fd;
+    int to_main_fd;
+    guint input_handle;
+
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+    GCancellable *cancellable;
+
+    std::atomic<bool> stopping;
+
+    // Only touched by the network thread
+    int active;
+
+public:
+
+    // done is called on the main loop for each finished request and takes ownership of it
+    NetThread(std::function<void(NetRequest *)> done);
+
+    // Requests that haven't been passed to done yet are deleted without it, so whatever their tags
+    // point to is left for the owner to free
+    ~NetThread();
+
+    // Takes ownership of the request. Returns false if the queue is full.
+    bool submit(NetRequest *req);
+
+private:
+
+    static void wake(int fd);
+    static void drain(int fd);
+
+    static gpointer thread_main(gpointer data);
+    static gboolean net_wake_cb(GIOChannel *, GIOCondition, gpointer data);
+    static void main_wake_cb(gpointer data, gint, PurpleInputCondition);
+
+    // Network thread
+    void start(NetRequest *req);
+    void write_next(NetRequest *req);
+    void read_next(NetRequest *req);
+    void finish(NetRequest *req, GError *err);
+    void maybe_quit();
+
+    static void connect_cb(GObject *source, GAsyncResult *res, gpointer data);
+    static void write_cb(GObject *source, GAsyncResult *res, gpointer data);
+    static void read_cb(GObject *source, GAsyncResult *res, gpointer data);
+
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <glib.h>
 
 #include <account.h>
+#include <accountopt.h>
 #include <debug.h>
 #include <prpl.h>
 #include <version.h>
@@ -44,8 +45,40 @@ static void init_info(PurplePluginInfo &i) {
     i.extra_info = (void *)&prpl_info;
 }
 
+static GList *init_protocol_options() {
+    GList *options = nullptr;
+
+    options = g_list_append(options, purple_account_option_bool_new(
+        "Downscale images before sending", LINE_ACCOUNT_SCALE_IMAGES, TRUE));
+
+    options = g_list_append(options, purple_account_option_int_new(
+        "Maximum image size (pixels)", LINE_ACCOUNT_IMAGE_MAX_SIZE, 2048));
+
+    options = g_list_append(options, purple_account_option_int_new(
+        "Image JPEG quality (1-100)", LINE_ACCOUNT_IMAGE_QUALITY, 85));
+
+    options = g_list_append(options, purple_account_option_int_new(
+        "Preview cache size (MB)", LINE_ACCOUNT_PREVIEW_CACHE_SIZE, 50));
+
+    options = g_list_append(options, purple_account_option_int_new(
+        "Duplicate message window (messages)", LINE_ACCOUNT_DEDUP_WINDOW, 1000));
+
+    options = g_list_append(options, purple_account_option_int_new(
+        "Skip buddy entries for chats larger than (0 = never)",
+        LINE_ACCOUNT_LAZY_MEMBERS_THRESHOLD, 200));
+
+    options = g_list_append(options, purple_account_option_bool_new(
+        "Decode large responses in the background", LINE_ACCOUNT_BACKGROUND_DECODE, FALSE));
+
+    options = g_list_append(options, purple_account_option_int_new(
+        "Append stats to a file every (seconds, 0 = never)", LINE_ACCOUNT_STATS_INTERVAL, 0));
+
+    return options;
+}
+
 static void init_prpl_info(PurplePluginProtocolInfo &i) {
     i.options = (PurpleProtocolOptions)OPT_PROTO_IM_IMAGE;
+    i.protocol_options = init_protocol_options();
     init_icon_spec(i.icon_spec);
 
     i.list_icon = &PurpleLine::list_icon;
@@ -63,6 +96,7 @@ static void init_prpl_info(PurplePluginProtocolInfo &i) {
     i.chat_leave = WRAPPER(PurpleLine::chat_leave);
     i.chat_send = WRAPPER(PurpleLine::chat_send);
     i.find_blist_chat = WRAPPER(PurpleLine::find_blist_chat);
+    i.get_cb_real_name = WRAPPER(PurpleLine::get_cb_real_name);
 
     i.struct_size = sizeof(PurplePluginProtocolInfo);
 }
@@ -4,6 +4,7 @@
 
 #include "constants.hpp"
 #include "poller.hpp"
+#include "projection.hpp"
 #include "purpleline.hpp"
 
 Poller::Poller(PurpleLine &parent)
@@ -11,6 +12,7 @@ Poller::Poller(PurpleLine &parent)
 {
     client = boost::make_shared<ThriftClient>(parent.acct, parent.conn, LINE_POLL_PATH);
     client->set_auto_reconnect(true);
+    client->set_stats(&parent.stats);
 }
 
 Poller::~Poller() {
@@ -22,120 +24,151 @@ void Poller::start() {
 }
 
 void Poller::fetch_operations() {
+    auto operations = std::make_shared<std::vector<line::Operation>>();
+    auto previews = std::make_shared<std::vector<BufferView>>();
+    gint64 start = g_get_monotonic_time();
+
     client->send_fetchOperations(local_rev, 50);
-    client->send([this]() {
-        int status = client->status_code();
+    client->send_raw(
+        [operations, previews](int status, const std::string &body) {
+            // Only successful responses have operations to decode
+            if (status != 200)
+                return;
 
-        if (status == -1) {
-            // Plugin closing
-            return;
-        } else if (status == 410) {
-            // Long poll timeout, resend
-            fetch_operations();
-            return;
-        } else if (status != 200) {
-            purple_debug_warning("line", "fetchOperations error %d. TODO: Retry after a timeout.\n",
-                status);
-            return;
-        }
+            static const FieldSet op_fields = field_set({ 1, 3, 10, 11, 12, 20 });
 
-        std::vector<line::Operation> operations;
-        client->recv_fetchOperations(operations);
-
-        for (line::Operation &op: operations) {
-            switch (op.type) {
-                case line::OpType::END_OF_OPERATION: // 0
-                    break;
-
-                case line::OpType::ADD_CONTACT: // 4
-                    parent.blist_update_buddy(op.param1);
-                    break;
-
-                case line::OpType::BLOCK_CONTACT: // 6
-                    parent.blist_remove_buddy(op.param1);
-                    break;
-
-                case line::OpType::UNBLOCK_CONTACT: // 7
-                    parent.blist_update_buddy(op.param1);
-                    break;
-
-                case line::OpType::CREATE_GROUP: // 9
-                case line::OpType::UPDATE_GROUP: // 10
-                case line::OpType::NOTIFIED_UPDATE_GROUP: // 11
-                case line::OpType::INVITE_INTO_GROUP: // 12
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::NOTIFIED_INVITE_INTO_GROUP: // 13
-                    op_notified_invite_into_group(op);
-                    break;
-
-                case line::OpType::LEAVE_GROUP: // 14
-                    parent.blist_remove_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::NOTIFIED_LEAVE_GROUP: // 15
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::ACCEPT_GROUP_INVITATION: // 16
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::NOTIFIED_ACCEPT_GROUP_INVITATION: // 17
-                case line::OpType::KICKOUT_FROM_GROUP: // 18
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::NOTIFIED_KICKOUT_FROM_GROUP: // 19
-                    op_notified_kickout_from_group(op);
-                    break;
-
-                case line::OpType::CREATE_ROOM: // 20
-                case line::OpType::INVITE_INTO_ROOM: // 21
-                    parent.blist_update_chat(op.param1, ChatType::ROOM);
-                    break;
-
-                case line::OpType::NOTIFIED_INVITE_INTO_ROOM: // 22
-                    // TODO: Perhaps show who invited the user (param2)
-                    parent.blist_update_chat(op.param1, ChatType::ROOM);
-                    break;
-
-                case line::OpType::LEAVE_ROOM: // 23
-                    parent.blist_remove_chat(op.param1, ChatType::ROOM);
-                    break;
-
-                case line::OpType::NOTIFIED_LEAVE_ROOM: // 24
-                    parent.blist_update_chat(op.param1, ChatType::ROOM);
-
-                case line::OpType::SEND_MESSAGE: // 25
-                case line::OpType::RECEIVE_MESSAGE: // 26
-                    parent.write_message(op.message, false);
-                    break;
-
-                case line::OpType::CANCEL_INVITATION_GROUP: // 31
-                case line::OpType::NOTIFIED_CANCEL_INVITATION_GROUP: // 32
-                    parent.blist_update_chat(op.param1, ChatType::GROUP);
-                    break;
-
-                case line::OpType::DUMMY: // 48;
-                    break;
-
-                case line::OpType::UPDATE_CONTACT: // 49
-                    parent.blist_update_buddy(op.param1);
-                    break;
-
-                default:
-                    purple_debug_warning("line", "Unhandled operation type: %d\n", op.type);
-                    break;
+            CompactReader r((const uint8_t *)body.data(), body.size());
+
+            read_reply(r, "fetchOperations", [&](CompactReader &r, int type) {
+                read_list(r, type, *operations, [&](line::Operation &op) {
+                    previews->emplace_back();
+                    read_operation(r, op, op_fields, ALL_FIELDS, &previews->back());
+                });
+            });
+        },
+        [this, operations, previews, start]() {
+            int status = client->status_code();
+
+            if (status == -1) {
+                // Plugin closing
+                return;
             }
 
-            if (op.revision > local_rev)
-                local_rev = op.revision;
-        }
+            parent.stats.add("poll_cycle_us", g_get_monotonic_time() - start);
 
-        fetch_operations();
-    });
+            if (status == 410) {
+                // Long poll timeout, resend
+                fetch_operations();
+                return;
+            } else if (status != 200) {
+                purple_debug_warning("line",
+                    "fetchOperations error %d. TODO: Retry after a timeout.\n", status);
+                return;
+            }
+
+            parent.stats.add("poll_ops", operations->size());
+
+            for (size_t i = 0; i < operations->size(); i++) {
+                line::Operation &op = (*operations)[i];
+
+                switch (op.type) {
+                    case line::OpType::END_OF_OPERATION: // 0
+                        break;
+
+                    case line::OpType::ADD_CONTACT: // 4
+                        parent.blist_update_buddy(op.param1);
+                        break;
+
+                    case line::OpType::BLOCK_CONTACT: // 6
+                        parent.blist_remove_buddy(op.param1);
+                        break;
+
+                    case line::OpType::UNBLOCK_CONTACT: // 7
+                        parent.blist_update_buddy(op.param1);
+                        break;
+
+                    case line::OpType::CREATE_GROUP: // 9
+                    case line::OpType::UPDATE_GROUP: // 10
+                    case line::OpType::NOTIFIED_UPDATE_GROUP: // 11
+                    case line::OpType::INVITE_INTO_GROUP: // 12
+                        parent.blist_update_chat(op.param1, ChatType::GROUP);
+                        break;
+
+                    case line::OpType::NOTIFIED_INVITE_INTO_GROUP: // 13
+                        op_notified_invite_into_group(op);
+                        break;
+
+                    case line::OpType::LEAVE_GROUP: // 14
+                        parent.blist_remove_chat(op.param1, ChatType::GROUP);
+                        break;
+
+                    case line::OpType::NOTIFIED_LEAVE_GROUP: // 15
+                        parent.blist_update_chat(op.param1, ChatType::GROUP);
+                        break;
+
+                    case line::OpType::ACCEPT_GROUP_INVITATION: // 16
+                        parent.blist_update_chat(op.param1, ChatType::GROUP);
+                        break;
+
+                    case line::OpType::NOTIFIED_ACCEPT_GROUP_INVITATION: // 17
+                    case line::OpType::KICKOUT_FROM_GROUP: // 18
+                        parent.blist_update_chat(op.param1, ChatType::GROUP);
+                        break;
+
+                    case line::OpType::NOTIFIED_KICKOUT_FROM_GROUP: // 19
+                        op_notified_kickout_from_group(op);
+                        break;
+
+                    case line::OpType::CREATE_ROOM: // 20
+                    case line::OpType::INVITE_INTO_ROOM: // 21
+                        parent.blist_update_chat(op.param1, ChatType::ROOM);
+                        break;
+
+                    case line::OpType::NOTIFIED_INVITE_INTO_ROOM: // 22
+                        // TODO: Perhaps show who invited the user (param2)
+                        parent.blist_update_chat(op.param1, ChatType::ROOM);
+                        break;
+
+                    case line::OpType::LEAVE_ROOM: // 23
+                        parent.blist_remove_chat(op.param1, ChatType::ROOM);
+                        break;
+
+                    case line::OpType::NOTIFIED_LEAVE_ROOM: // 24
+                        parent.blist_update_chat(op.param1, ChatType::ROOM);
+
+                    case line::OpType::SEND_MESSAGE: // 25
+                    case line::OpType::RECEIVE_MESSAGE: // 26
+                        // Previews are still in the response buffer, and are only worth copying
+                        // out for messages that aren't duplicates
+                        if (!parent.recent_messages.contains(op.message.id))
+                            set_preview(op.message, (*previews)[i]);
+
+                        parent.write_message(op.message, false);
+                        break;
+
+                    case line::OpType::CANCEL_INVITATION_GROUP: // 31
+                    case line::OpType::NOTIFIED_CANCEL_INVITATION_GROUP: // 32
+                        parent.blist_update_chat(op.param1, ChatType::GROUP);
+                        break;
+
+                    case line::OpType::DUMMY: // 48;
+                        break;
+
+                    case line::OpType::UPDATE_CONTACT: // 49
+                        parent.blist_update_buddy(op.param1);
+                        break;
+
+                    default:
+                        purple_debug_warning("line", "Unhandled operation type: %d\n", op.type);
+                        break;
+                }
+
+                if (op.revision > local_rev)
+                    local_rev = op.revision;
+            }
+
+            fetch_operations();
+        });
 }
 
 void Poller::op_notified_kickout_from_group(line::Operation &op) {
@@ -149,8 +182,9 @@ void Poller::op_notified_kickout_from_group(line::Operation &op) {
         parent.blist_update_chat(op.param1, ChatType::GROUP);
     }
 
-    if (parent.contacts.count(op.param2) == 1)
-        msg += parent.contacts[op.param2].displayName;
+    ContactPtr contact = parent.store.get_contact(op.param2);
+    if (contact)
+        msg += contact->displayName;
     else
         msg += "(unknown contact)";
 
@@ -172,28 +206,40 @@ void Poller::op_notified_kickout_from_group(line::Operation &op) {
 void Poller::op_notified_invite_into_group(line::Operation &op) {
     // TODO: Maybe use cached objects instead of re-requesting every time
 
-    parent.c_out->send_getGroup(op.param1);
-    parent.c_out->send([this, op]{
-        line::Group group;
-        parent.c_out->recv_getGroup(group);
+    std::string request;
+    CompactWriter w(request);
+    line_codec::write_getGroup(w, op.param1);
+
+    // Only the name is shown, so skip the member lists
+    Future<line::Group> fetched = parent.c_out->call<line::Group>(
+        std::move(request),
+        [](CompactReader &r, line::Group &group) {
+            read_reply(r, "getGroup", [&](CompactReader &r, int type) {
+                if (type == CompactReader::STRUCT)
+                    read_group(r, group, field_set({ 1, 10 }), 0);
+                else
+                    r.skip(type);
+            });
+        });
+
+    std::string group_id = op.param1, inviter_id = op.param2, invitee_id = op.param3;
 
+    fetched.then([this, group_id, inviter_id, invitee_id](line::Group &group) {
+        // Contacts are only requested for a known group, as getContact on the IDs of an unknown
+        // one may fail and end the connection
         if (!group.__isset.id) {
-            purple_debug_warning("line", "Invited into unknown group: %s\n", op.param1.c_str());
+            purple_debug_warning("line", "Invited into unknown group: %s\n", group_id.c_str());
             return;
         }
 
-        parent.c_out->send_getContact(op.param2);
-        parent.c_out->send([this, group, op]() mutable {
-            line::Contact inviter;
-            parent.c_out->recv_getContact(inviter);
-
-            parent.c_out->send_getContact(op.param3);
-            parent.c_out->send([this, group, inviter, op]() mutable {
-                line::Contact invitee;
-                parent.c_out->recv_getContact(invitee);
+        // The inviter and invitee are requested at the same time instead of one after another
+        Future<std::vector<line::Contact>> contacts = all_of(std::vector<Future<line::Contact>> {
+            line_codec::getContact(*parent.c_out, inviter_id),
+            line_codec::getContact(*parent.c_out, invitee_id),
+        });
 
-                parent.handle_group_invite(group, invitee, inviter);
-            });
+        contacts.then([this, group](std::vector<line::Contact> &contacts) mutable {
+            parent.handle_group_invite(group, contacts[1], contacts[0]);
         });
     });
 }
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <vector>
+
+#include <glib/gstdio.h>
+
+#include <debug.h>
+
+#include "previewcache.hpp"
+
+PreviewCache::PreviewCache() :
+    max_size(0),
+    total_size(0)
+{
+}
+
+void PreviewCache::open(std::string dir, size_t max_size) {
+    this->dir = dir;
+    this->max_size = max_size;
+
+    total_size = 0;
+    lru.clear();
+    index.clear();
+
+    GDir *gdir = g_dir_open(dir.c_str(), 0, nullptr);
+    if (!gdir)
+        return;
+
+    // File modification times are used to restore the usage order
+
+    std::vector<std::pair<time_t, Entry>> entries;
+
+    while (const gchar *name = g_dir_read_name(gdir)) {
+        std::string id(name);
+
+        if (!valid_id(id))
+            continue;
+
+        GStatBuf st;
+        if (g_stat(path(id).c_str(), &st) != 0)
+            continue;
+
+        entries.push_back(std::make_pair(st.st_mtime, Entry { id, (size_t)st.st_size }));
+    }
+
+    g_dir_close(gdir);
+
+    std::sort(entries.begin(), entries.end(),
+        [](const std::pair<time_t, Entry> &a, const std::pair<time_t, Entry> &b) {
+            return a.first > b.first;
+        });
+
+    for (auto &e: entries) {
+        lru.push_back(e.second);
+        index[e.second.id] = std::prev(lru.end());
+        total_size += e.second.size;
+    }
+
+    evict();
+
+    purple_debug_info("line", "Preview cache: %d previews, %d bytes\n",
+        (int)lru.size(), (int)total_size);
+}
+
+bool PreviewCache::get(std::string id, std::string &data) {
+    auto i = index.find(id);
+    if (i == index.end())
+        return false;
+
+    std::string file_path = path(id);
+
+    gchar *contents;
+    gsize len;
+
+    if (!g_file_get_contents(file_path.c_str(), &contents, &len, nullptr)) {
+        total_size -= i->second->size;
+        lru.erase(i->second);
+        index.erase(i);
+
+        return false;
+    }
+
+    data.assign(contents, len);
+    g_free(contents);
+
+    lru.splice(lru.begin(), lru, i->second);
+    g_utime(file_path.c_str(), nullptr);
+
+    return true;
+}
+
+void PreviewCache::put(std::string id, const guchar *data, gsize len) {
+    if (dir == "" || !valid_id(id) || index.count(id) || len > max_size)
+        return;
+
+    if (!g_file_set_contents(path(id).c_str(), (const gchar *)data, len, nullptr))
+        return;
+
+    lru.push_front(Entry { id, len });
+    index[id] = lru.begin();
+    total_size += len;
+
+    evict();
+}
+
+// Message IDs are numeric. Anything else is not a cache file and shouldn't be used as a path.
+bool PreviewCache::valid_id(std::string &id) {
+    return !id.empty() && id.size() < 64
+        && std::all_of(id.begin(), id.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+std::string PreviewCache::path(std::string &id) {
+    gchar *path_p = g_build_filename(dir.c_str(), id.c_str(), nullptr);
+    std::string path(path_p);
+    g_free(path_p);
+
+    return path;
+}
+
+void PreviewCache::evict() {
+    while (total_size > max_size && !lru.empty()) {
+        Entry &e = lru.back();
+
+        g_unlink(path(e.id).c_str());
+
+        total_size -= e.size;
+        index.erase(e.id);
+        lru.pop_back();
+    }
+}
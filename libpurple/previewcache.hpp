@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+
+#include <glib.h>
+
+// On-disk cache for image and video message previews, keyed by message ID. Previews never change
+// for a message, so cached ones are used without asking the server. The total size of the cache is
+// capped and the least recently used previews are evicted first.
+class PreviewCache {
+
+    struct Entry {
+        std::string id;
+        size_t size;
+    };
+
+    std::string dir;
+    size_t max_size;
+    size_t total_size;
+
+    // Most recently used first
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+public:
+
+    PreviewCache();
+
+    void open(std::string dir, size_t max_size);
+
+    bool get(std::string id, std::string &data);
+    void put(std::string id, const guchar *data, gsize len);
+
+private:
+
+    static bool valid_id(std::string &id);
+
+    std::string path(std::string &id);
+    void evict();
+
+};
@@ -0,0 +1,230 @@
+#include "projection.hpp"
+
+static inline bool wanted(FieldSet fields, int16_t id) {
+    return id >= 0 && id < 64 && (fields & ((FieldSet)1 << id));
+}
+
+void read_contact(CompactReader &r, line::Contact &contact, FieldSet fields) {
+    int16_t id;
+    int type;
+
+    r.read_struct_begin();
+
+    while (r.read_field(id, type)) {
+        if (!wanted(fields, id)) {
+            r.skip(type);
+            continue;
+        }
+
+        if (id == 1 && type == CompactReader::BINARY) {
+            r.read_string(contact.mid);
+            contact.__isset.mid = true;
+        } else if (id == 11 && type == CompactReader::I32) {
+            contact.status = (line::ContactStatus::type)r.read_i32();
+            contact.__isset.status = true;
+        } else if (id == 22 && type == CompactReader::BINARY) {
+            r.read_string(contact.displayName);
+            contact.__isset.displayName = true;
+        } else if (id == 26 && type == CompactReader::BINARY) {
+            r.read_string(contact.statusMessage);
+            contact.__isset.statusMessage = true;
+        } else if (id == 35 && type == CompactReader::I32) {
+            contact.attributes = r.read_i32();
+            contact.__isset.attributes = true;
+        } else if (id == 37 && type == CompactReader::BINARY) {
+            r.read_string(contact.picturePath);
+            contact.__isset.picturePath = true;
+        } else {
+            r.skip(type);
+        }
+    }
+}
+
+void read_group(CompactReader &r, line::Group &group, FieldSet fields, FieldSet member_fields) {
+    auto read_member = [&r, member_fields](line::Contact &c) {
+        read_contact(r, c, member_fields);
+    };
+
+    int16_t id;
+    int type;
+
+    r.read_struct_begin();
+
+    while (r.read_field(id, type)) {
+        if (!wanted(fields, id)) {
+            r.skip(type);
+            continue;
+        }
+
+        if (id == 1 && type == CompactReader::BINARY) {
+            r.read_string(group.id);
+            group.__isset.id = true;
+        } else if (id == 10 && type == CompactReader::BINARY) {
+            r.read_string(group.name);
+            group.__isset.name = true;
+        } else if (id == 20) {
+            read_list(r, type, group.members, read_member);
+            group.__isset.members = true;
+        } else if (id == 21 && type == CompactReader::STRUCT) {
+            read_contact(r, group.creator, member_fields);
+            group.__isset.creator = true;
+        } else if (id == 22) {
+            read_list(r, type, group.invitee, read_member);
+            group.__isset.invitee = true;
+        } else {
+            r.skip(type);
+        }
+    }
+}
+
+static void read_location(CompactReader &r, line::Location &loc) {
+    int16_t id;
+    int type;
+
+    r.read_struct_begin();
+
+    while (r.read_field(id, type)) {
+        if (id == 1 && type == CompactReader::BINARY) {
+            r.read_string(loc.title);
+            loc.__isset.title = true;
+        } else if (id == 2 && type == CompactReader::BINARY) {
+            r.read_string(loc.address);
+            loc.__isset.address = true;
+        } else if (id == 3 && type == CompactReader::DOUBLE) {
+            loc.latitude = r.read_double();
+            loc.__isset.latitude = true;
+        } else if (id == 4 && type == CompactReader::DOUBLE) {
+            loc.longitude = r.read_double();
+            loc.__isset.longitude = true;
+        } else {
+            r.skip(type);
+        }
+    }
+}
+
+static void read_metadata(CompactReader &r, int type, std::map<std::string, std::string> &meta) {
+    if (type != CompactReader::MAP) {
+        r.skip(type);
+        return;
+    }
+
+    int key_type, value_type;
+    uint32_t size = r.read_map_begin(key_type, value_type);
+
+    for (uint32_t i = 0; i < size; i++) {
+        if (key_type != CompactReader::BINARY || value_type != CompactReader::BINARY) {
+            r.skip(key_type);
+            r.skip(value_type);
+            continue;
+        }
+
+        BufferView key = r.read_binary();
+        BufferView value = r.read_binary();
+
+        meta[key.str()].assign((const char *)value.data, value.size);
+    }
+}
+
+void read_message(CompactReader &r, line::Message &msg, FieldSet fields, BufferView *preview) {
+    int16_t id;
+    int type;
+
+    r.read_struct_begin();
+
+    while (r.read_field(id, type)) {
+        if (!wanted(fields, id)) {
+            r.skip(type);
+            continue;
+        }
+
+        if (id == 1 && type == CompactReader::BINARY) {
+            r.read_string(msg.from_);
+            msg.__isset.from_ = true;
+        } else if (id == 2 && type == CompactReader::BINARY) {
+            r.read_string(msg.to);
+            msg.__isset.to = true;
+        } else if (id == 3 && type == CompactReader::I32) {
+            msg.toType = (line::MIDType::type)r.read_i32();
+            msg.__isset.toType = true;
+        } else if (id == 4 && type == CompactReader::BINARY) {
+            r.read_string(msg.id);
+            msg.__isset.id = true;
+        } else if (id == 5 && type == CompactReader::I64) {
+            msg.createdTime = r.read_i64();
+            msg.__isset.createdTime = true;
+        } else if (id == 10 && type == CompactReader::BINARY) {
+            r.read_string(msg.text);
+            msg.__isset.text = true;
+        } else if (id == 11 && type == CompactReader::STRUCT) {
+            read_location(r, msg.location);
+            msg.__isset.location = true;
+        } else if (id == 15 && type == CompactReader::I32) {
+            msg.contentType = (line::ContentType::type)r.read_i32();
+            msg.__isset.contentType = true;
+        } else if (id == 17 && type == CompactReader::BINARY) {
+            if (preview) {
+                *preview = r.read_binary();
+            } else {
+                r.read_string(msg.contentPreview);
+                msg.__isset.contentPreview = true;
+            }
+        } else if (id == 18) {
+            read_metadata(r, type, msg.contentMetadata);
+            msg.__isset.contentMetadata = true;
+        } else {
+            r.skip(type);
+        }
+    }
+}
+
+void set_preview(line::Message &msg, const BufferView &preview) {
+    if (!preview.data)
+        return;
+
+    msg.contentPreview.assign((const char *)preview.data, preview.size);
+    msg.__isset.contentPreview = true;
+}
+
+void read_operation(CompactReader &r, line::Operation &op, FieldSet fields,
+    FieldSet message_fields, BufferView *preview)
+{
+    int16_t id;
+    int type;
+
+    r.read_struct_begin();
+
+    while (r.read_field(id, type)) {
+        if (!wanted(fields, id)) {
+            r.skip(type);
+            continue;
+        }
+
+        if (id == 1 && type == CompactReader::I64) {
+            op.revision = r.read_i64();
+            op.__isset.revision = true;
+        } else if (id == 2 && type == CompactReader::I64) {
+            op.createdTime = r.read_i64();
+            op.__isset.createdTime = true;
+        } else if (id == 3 && type == CompactReader::I32) {
+            op.type = (line::OpType::type)r.read_i32();
+            op.__isset.type = true;
+        } else if (id == 4 && type == CompactReader::I32) {
+            op.reqSeq = r.read_i32();
+            op.__isset.reqSeq = true;
+        } else if (id == 10 && type == CompactReader::BINARY) {
+            r.read_string(op.param1);
+            op.__isset.param1 = true;
+        } else if (id == 11 && type == CompactReader::BINARY) {
+            r.read_string(op.param2);
+            op.__isset.param2 = true;
+        } else if (id == 12 && type == CompactReader::BINARY) {
+            r.read_string(op.param3);
+            op.__isset.param3 = true;
+        } else if (id == 20 && type == CompactReader::STRUCT) {
+            read_message(r, op.message, message_fields, preview);
+            op.__isset.message = true;
+        } else {
+            r.skip(type);
+        }
+    }
+}
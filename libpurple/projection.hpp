@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <initializer_list>
+#include <string>
+
+#include "thrift_line/line_codec.hpp"
+
+#include "compactreader.hpp"
+
+// Readers for LINE types that only decode the fields a caller asks for. Everything else is skipped
+// in the receive buffer without being copied.
+
+// Set of field IDs to decode, one bit per ID. All the fields the plugin uses have IDs below 64.
+typedef uint64_t FieldSet;
+
+const FieldSet ALL_FIELDS = ~(FieldSet)0;
+
+inline FieldSet field_set(std::initializer_list<int> ids) {
+    FieldSet fields = 0;
+
+    for (int id: ids)
+        fields |= (FieldSet)1 << id;
+
+    return fields;
+}
+
+void read_contact(CompactReader &r, line::Contact &contact, FieldSet fields);
+void read_group(CompactReader &r, line::Group &group, FieldSet fields, FieldSet member_fields);
+
+// If preview is not null, contentPreview is left in the receive buffer and only a view to it is
+// returned. Previews can be large and most messages that have one are never displayed.
+void read_message(CompactReader &r, line::Message &msg, FieldSet fields, BufferView *preview);
+void read_operation(CompactReader &r, line::Operation &op, FieldSet fields,
+    FieldSet message_fields, BufferView *preview);
+
+// Copies a preview left in the receive buffer by read_message into the message
+void set_preview(line::Message &msg, const BufferView &preview);
+
+// Reads the reply to a call of method, and calls read_success to read the return value. Errors
+// are thrown the same way as by the generated recv_* functions.
+template <typename F>
+void read_reply(CompactReader &r, const char *method, F read_success) {
+    line_codec::read_reply_begin(r, method);
+
+    bool success = false;
+    line::TalkException e;
+    bool has_e = false;
+
+    int16_t id;
+    int type;
+
+    r.read_struct_begin();
+
+    while (r.read_field(id, type)) {
+        if (id == 0) {
+            read_success(r, type);
+            success = true;
+        } else if (id == 1) {
+            has_e = line_codec::read_field(r, type, e);
+        } else {
+            r.skip(type);
+        }
+    }
+
+    if (has_e)
+        throw e;
+
+    if (!success) {
+        throw apache::thrift::TApplicationException(
+            apache::thrift::TApplicationException::MISSING_RESULT,
+            std::string(method) + " failed: unknown result");
+    }
+}
+
+// Reads a list of structs with read_elem, which is called once per element
+template <typename T, typename F>
+void read_list(CompactReader &r, int type, std::vector<T> &list, F read_elem) {
+    if (type != CompactReader::LIST) {
+        r.skip(type);
+        return;
+    }
+
+    int elem_type;
+    uint32_t size = r.read_list_begin(elem_type);
+
+    if (elem_type != CompactReader::STRUCT) {
+        for (uint32_t i = 0; i < size; i++)
+            r.skip(elem_type);
+
+        return;
+    }
+
+    list.resize(size);
+
+    for (uint32_t i = 0; i < size; i++)
+        read_elem(list[i]);
+}
@@ -1,7 +1,10 @@
 #include <algorithm>
 #include <functional>
 #include <memory>
+#include <sstream>
+#include <unordered_set>
 
+#include <stdio.h>
 #include <time.h>
 
 #include <glib.h>
@@ -12,22 +15,16 @@
 #include <conversation.h>
 #include <debug.h>
 #include <eventloop.h>
+#include <imgstore.h>
 #include <notify.h>
 #include <request.h>
 #include <sslconn.h>
 #include <util.h>
 
+#include "imagescaler.hpp"
 #include "purpleline.hpp"
 #include "wrapper.hpp"
 
-std::string markup_escape(std::string const &text) {
-    gchar *escaped = purple_markup_escape_text(text.c_str(), text.size());
-    std::string result(escaped);
-    g_free(escaped);
-
-    return result;
-}
-
 std::string markup_unescape(std::string const &markup) {
     gchar *unescaped = purple_unescape_html(markup.c_str());
     std::string result(unescaped);
@@ -43,14 +40,23 @@ std::string url_encode(std::string const &str) {
 PurpleLine::PurpleLine(PurpleConnection *conn, PurpleAccount *acct) :
     conn(conn),
     acct(acct),
+    stats_timeout(0),
     http(acct),
-    os_http(acct, conn, LINE_OS_SERVER, 443, false),
+    icons(acct, http),
+    uploads(acct, conn),
+    workers(1),
     poller(*this),
     pin_verifier(*this),
-    next_purple_id(1)
+    next_purple_id(1),
+    recent_messages(std::max(50, purple_account_get_int(acct, LINE_ACCOUNT_DEDUP_WINDOW, 1000))),
+    warm_messages(WARM_MESSAGES_PER_BOX),
+    stat_buddy_updates_applied(0),
+    stat_buddy_updates_skipped(0)
 {
     c_out = boost::make_shared<ThriftClient>(acct, conn, LINE_LOGIN_PATH);
-    os_http.set_auto_reconnect(true);
+    c_out->set_stats(&stats);
+
+    http.set_stats(&stats);
 }
 
 PurpleLine::~PurpleLine() {
@@ -119,6 +125,83 @@ std::string PurpleLine::get_tmp_dir(bool create) {
     return dir;
 }
 
+std::string PurpleLine::get_data_dir(std::string name) {
+    std::string mid = profile.mid;
+
+    for (char c: mid) {
+        if (!(std::isalpha(c) || std::isdigit(c))) {
+            mid = "default";
+            break;
+        }
+    }
+
+    gchar *dir_p = g_build_filename(
+        purple_user_dir(),
+        "line",
+        mid.c_str(),
+        name.c_str(),
+        nullptr);
+
+    g_mkdir_with_parents(dir_p, 0700);
+
+    std::string dir(dir_p);
+
+    g_free(dir_p);
+
+    return dir;
+}
+
+std::string PurpleLine::stats_report() {
+    std::stringstream ss;
+
+    ss
+        << stats.report()
+        << "buddy_updates_applied: " << stat_buddy_updates_applied << "\n"
+        << "buddy_updates_skipped: " << stat_buddy_updates_skipped << "\n"
+        << "uploads: " << uploads.stats() << "\n";
+
+    return ss.str();
+}
+
+void PurpleLine::stats_start_snapshots() {
+    int interval = purple_account_get_int(acct, LINE_ACCOUNT_STATS_INTERVAL, 0);
+    if (interval <= 0 || stats_timeout)
+        return;
+
+    stats_path = get_data_dir("stats") + G_DIR_SEPARATOR_S "stats.log";
+
+    stats_timeout = purple_timeout_add_seconds(
+        interval,
+        WRAPPER(PurpleLine::stats_timeout_cb),
+        (gpointer)this);
+}
+
+// Appends the current stats to the snapshot file, each line prefixed with the time so that
+// snapshots from many sessions can be collected and compared
+int PurpleLine::stats_timeout_cb() {
+    std::stringstream report(stats_report());
+    std::stringstream ss;
+    std::string line;
+
+    long now = (long)time(NULL);
+
+    while (std::getline(report, line))
+        ss << now << " " << line << "\n";
+
+    std::string data = ss.str();
+
+    FILE *f = g_fopen(stats_path.c_str(), "ab");
+    if (!f)
+        return TRUE;
+
+    bool ok = (fwrite(data.data(), 1, data.size(), f) == data.size());
+
+    if (fclose(f) != 0 || !ok)
+        purple_debug_warning("line", "Couldn't write stats snapshot\n");
+
+    return TRUE;
+}
+
 char *PurpleLine::status_text(PurpleBuddy *buddy) {
     PurplePresence *presence = purple_buddy_get_presence(buddy);
     PurpleStatus *status = purple_presence_get_active_status(presence);
@@ -158,6 +241,8 @@ void PurpleLine::login(PurpleAccount *acct) {
     conn->proto_data = (void *)plugin;
 
     plugin->connect_signals();
+    plugin->blist_index_chats();
+    plugin->conv_refs_build();
 
     plugin->login_start();
 }
@@ -165,6 +250,19 @@ void PurpleLine::login(PurpleAccount *acct) {
 void PurpleLine::close() {
     disconnect_signals();
 
+    if (stats_timeout) {
+        purple_timeout_remove(stats_timeout);
+        stats_timeout = 0;
+    }
+
+    // Conversations outlive the connection, so don't leave replays running on them
+    for (GList *convs = purple_get_conversations(); convs; convs = g_list_next(convs)) {
+        PurpleConversation *conv = (PurpleConversation *)convs->data;
+
+        if (purple_conversation_get_account(conv) == acct)
+            history_replay_cancel(conv);
+    }
+
     if (temp_files.size()) {
         for (std::string &path: temp_files)
             g_unlink(path.c_str());
@@ -176,6 +274,13 @@ void PurpleLine::close() {
 }
 
 void PurpleLine::connect_signals() {
+    purple_signal_connect(
+        purple_blist_get_handle(),
+        "blist-node-added",
+        (void *)this,
+        PURPLE_CALLBACK(WRAPPER_TYPE(PurpleLine::signal_blist_node_added, signal)),
+        (void *)this);
+
     purple_signal_connect(
         purple_blist_get_handle(),
         "blist-node-removed",
@@ -196,9 +301,29 @@ void PurpleLine::connect_signals() {
         (void *)this,
         PURPLE_CALLBACK(WRAPPER_TYPE(PurpleLine::signal_deleting_conversation, signal)),
         (void *)this);
+
+    purple_signal_connect(
+        purple_conversations_get_handle(),
+        "chat-buddy-joined",
+        (void *)this,
+        PURPLE_CALLBACK(WRAPPER_TYPE(PurpleLine::signal_chat_buddy_joined, signal)),
+        (void *)this);
+
+    purple_signal_connect(
+        purple_conversations_get_handle(),
+        "chat-buddy-left",
+        (void *)this,
+        PURPLE_CALLBACK(WRAPPER_TYPE(PurpleLine::signal_chat_buddy_left, signal)),
+        (void *)this);
 }
 
 void PurpleLine::disconnect_signals() {
+    purple_signal_disconnect(
+        purple_blist_get_handle(),
+        "blist-node-added",
+        (void *)this,
+        PURPLE_CALLBACK(WRAPPER_TYPE(PurpleLine::signal_blist_node_added, signal)));
+
     purple_signal_disconnect(
         purple_blist_get_handle(),
         "blist-node-removed",
@@ -217,6 +342,18 @@ void PurpleLine::disconnect_signals() {
         "deleting-conversation",
         (void *)this,
         PURPLE_CALLBACK(WRAPPER_TYPE(PurpleLine::signal_deleting_conversation, signal)));
+
+    purple_signal_disconnect(
+        purple_conversations_get_handle(),
+        "chat-buddy-joined",
+        (void *)this,
+        PURPLE_CALLBACK(WRAPPER_TYPE(PurpleLine::signal_chat_buddy_joined, signal)));
+
+    purple_signal_disconnect(
+        purple_conversations_get_handle(),
+        "chat-buddy-left",
+        (void *)this,
+        PURPLE_CALLBACK(WRAPPER_TYPE(PurpleLine::signal_chat_buddy_left, signal)));
 }
 
 std::string PurpleLine::conv_attachment_add(PurpleConversation *conv,
@@ -248,10 +385,6 @@ PurpleLine::Attachment *PurpleLine::conv_attachment_get(PurpleConversation *conv
     return (atts && index <= (int)atts->size()) ? &(*atts)[index - 1] : nullptr;
 }
 
-line::Contact &PurpleLine::get_up_to_date_contact(line::Contact &c) {
-    return (contacts.count(c.mid) != 0) ? contacts[c.mid] : c;
-}
-
 int PurpleLine::send_message(std::string to, const char *markup) {
     // Parse markup and send message as parts if it contains images
 
@@ -308,19 +441,7 @@ int PurpleLine::send_message(std::string to, const char *markup) {
                 continue;
             }
 
-            std::string img_data(
-                (const char *)purple_imgstore_get_data(img),
-                purple_imgstore_get_size(img));
-
-            line::Message msg;
-
-            msg.contentType = line::ContentType::IMAGE;
-            msg.from_ = profile.mid;
-            msg.to = to;
-
-            send_message(msg, [this, img_data](line::Message &msg_back) {
-                upload_media(msg_back.id, "image", img_data);
-            });
+            send_image(to, img);
 
             any_sent = true;
         }
@@ -364,26 +485,118 @@ void PurpleLine::send_message(
         }
 
         // Kludge >_>
-        if (to[0] == 'u')
-            push_recent_message(msg_back.id);
+        if (to[0] == 'u') {
+            recent_messages.insert(msg_back.id);
+
+            // The poller won't write this one, so store it here
+            warm_messages.push(to, msg_back);
+            message_log.append_live(to, msg_back);
+            index_message(to, msg_back);
+        }
 
         if (callback)
             callback(msg_back);
     });
 }
 
-void PurpleLine::upload_media(std::string message_id, std::string type, std::string data) {
+void PurpleLine::send_image(std::string to, PurpleStoredImage *img) {
+    // Hold on to the stored image instead of copying its data. The reference is dropped once the
+    // upload is done with it.
+    purple_imgstore_ref(img);
+
+    std::shared_ptr<const void> img_ref(img, [](PurpleStoredImage *img) {
+        purple_imgstore_unref(img);
+    });
+
+    static std::map<std::string, std::string> mime_types = {
+        { "png", "image/png" },
+        { "gif", "image/gif" },
+        { "bmp", "image/bmp" },
+    };
+
+    std::string mime_type = "image/jpeg";
+
+    const char *ext = purple_imgstore_get_extension(img);
+    if (ext && mime_types.count(ext))
+        mime_type = mime_types[ext];
+
+    line::Message msg;
+
+    msg.contentType = line::ContentType::IMAGE;
+    msg.from_ = profile.mid;
+    msg.to = to;
+
+    send_message(msg, [this, to, img, img_ref, mime_type](line::Message &msg_back) {
+        std::string message_id = msg_back.id;
+
+        LineHttpTransport::BodyPart original(
+            purple_imgstore_get_data(img),
+            purple_imgstore_get_size(img),
+            img_ref);
+
+        if (!purple_account_get_bool(acct, LINE_ACCOUNT_SCALE_IMAGES, TRUE)) {
+            upload_media(to, message_id, "image", mime_type, original);
+            return;
+        }
+
+        // Downscale and recompress on a worker thread. The result is only used if it's smaller
+        // than the original.
+
+        ImageScaler scaler(
+            purple_account_get_int(acct, LINE_ACCOUNT_IMAGE_MAX_SIZE, 2048),
+            purple_account_get_int(acct, LINE_ACCOUNT_IMAGE_QUALITY, 85));
+
+        // The scaled image is freed along with the pair, so that it isn't leaked if the account
+        // is closed before the done function runs
+        std::shared_ptr<std::pair<gchar *, gsize>> scaled(
+            new std::pair<gchar *, gsize>(nullptr, 0),
+            [](std::pair<gchar *, gsize> *p) {
+                g_free(p->first);
+                delete p;
+            });
+
+        workers.run(
+            [scaler, original, scaled]() mutable {
+                if (!scaler.scale(
+                    (const guchar *)original.data(), original.size(),
+                    &scaled->first, &scaled->second))
+                {
+                    scaled->first = nullptr;
+                }
+            },
+            [this, to, message_id, mime_type, original, scaled]() {
+                if (!scaled->first) {
+                    upload_media(to, message_id, "image", mime_type, original);
+                    return;
+                }
+
+                purple_debug_info("line", "Scaled image from %d to %d bytes\n",
+                    (int)original.size(), (int)scaled->second);
+
+                upload_media(to, message_id, "image", "image/jpeg",
+                    LineHttpTransport::BodyPart(scaled->first, scaled->second, scaled));
+            });
+    });
+}
+
+void PurpleLine::upload_media(std::string to, std::string message_id, std::string type,
+    std::string mime_type, LineHttpTransport::BodyPart data)
+{
     std::string boundary;
 
     do {
         gchar *random_string = purple_uuid_random();
         boundary = random_string;
         g_free(random_string);
-    } while (data.find(boundary) != std::string::npos);
+    } while (std::search(data.data(), data.data() + data.size(), boundary.begin(), boundary.end())
+        != data.data() + data.size());
 
-    std::stringstream body;
+    // The multipart preamble and epilogue are sent around the media data, which is written to the
+    // connection directly from its buffer.
 
-    body
+    std::stringstream head;
+
+    head
         << "--" << boundary << "\r\n"
         << "Content-Disposition: form-data; name=\"params\"\r\n"
         << "\r\n"
@@ -396,29 +609,17 @@ void PurpleLine::upload_media(std::string message_id, std::string type, std::str
         << "}"
         << "\r\n--" << boundary << "\r\n"
         << "Content-Disposition: form-data; name=\"file\"; filename=\"media\"\r\n"
-        << "Content-Type: image/jpeg\r\n"
-        << "\r\n"
-        << data
-        << "\r\n--" << boundary << "--\r\n";
+        << "Content-Type: " << mime_type << "\r\n"
+        << "\r\n";
 
-    std::string content_type = std::string("multipart/form-data; boundary=") + boundary;
+    std::vector<LineHttpTransport::BodyPart> body;
+    body.emplace_back(head.str());
+    body.push_back(std::move(data));
+    body.emplace_back("\r\n--" + boundary + "--\r\n");
 
-    os_http.write_virt((const uint8_t *)body.str().c_str(), body.tellp());
-
-    os_http.request("POST", "/talk/m/upload.nhn", content_type, [this]() {
-        if (os_http.status_code() != 201) {
-            purple_debug_warning(
-                "line",
-                "Couldn't upload message media. Status: %d\n",
-                os_http.status_code());
-        }
-    });
-}
+    std::string content_type = std::string("multipart/form-data; boundary=") + boundary;
 
-void PurpleLine::push_recent_message(std::string id) {
-    recent_messages.push_back(id);
-    if (recent_messages.size() > 50)
-        recent_messages.pop_front();
+    uploads.upload(to, type, "/talk/m/upload.nhn", content_type, std::move(body));
 }
 
 int PurpleLine::send_im(const char *who, const char *message, PurpleMessageFlags flags) {
@@ -440,13 +641,32 @@ void PurpleLine::remove_buddy(PurpleBuddy *buddy, PurpleGroup *) {
     });
 }
 
+void PurpleLine::signal_blist_node_added(PurpleBlistNode *node) {
+    if (!(PURPLE_BLIST_NODE_IS_CHAT(node)
+        && purple_chat_get_account(PURPLE_CHAT(node)) == acct))
+    {
+        return;
+    }
+
+    blist_index_chat_add(PURPLE_CHAT(node));
+}
+
 void PurpleLine::signal_blist_node_removed(PurpleBlistNode *node) {
+    if (PURPLE_BLIST_NODE_IS_BUDDY(node)
+        && purple_buddy_get_account(PURPLE_BUDDY(node)) == acct)
+    {
+        buddy_fingerprints.erase(purple_buddy_get_name(PURPLE_BUDDY(node)));
+        return;
+    }
+
     if (!(PURPLE_BLIST_NODE_IS_CHAT(node)
         && purple_chat_get_account(PURPLE_CHAT(node)) == acct))
     {
         return;
     }
 
+    blist_index_chat_remove(PURPLE_CHAT(node));
+
     GHashTable *components = purple_chat_get_components(PURPLE_CHAT(node));
 
     char *id_ptr = (char *)g_hash_table_lookup(components, "id");
@@ -487,6 +707,12 @@ void PurpleLine::signal_conversation_created(PurpleConversation *conv) {
     if (purple_conversation_get_account(conv) != acct)
         return;
 
+    if (purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_IM) {
+        conv_refs_add(purple_conversation_get_name(conv));
+        blist_materialize_buddy(purple_conversation_get_name(conv));
+        icons.prioritize(purple_conversation_get_name(conv));
+    }
+
     // Start queuing messages while the history is fetched
     purple_conversation_set_data(conv, "line-message-queue", new std::vector<line::Message>());
 
@@ -494,133 +720,362 @@ void PurpleLine::signal_conversation_created(PurpleConversation *conv) {
 }
 
 void PurpleLine::fetch_conversation_history(PurpleConversation *conv, int count, bool requested) {
+    auto replay = (HistoryReplay *)purple_conversation_get_data(conv, "line-history-replay");
+
+    if (!replay) {
+        replay = new HistoryReplay();
+        replay->parent = this;
+        replay->conv = conv;
+        replay->remaining = 0;
+        replay->requested = false;
+        replay->fetching = false;
+        replay->any_written = false;
+        replay->page_pos = 0;
+        replay->idle_handle = 0;
+
+        purple_conversation_set_data(conv, "line-history-replay", replay);
+
+        // Hold back live messages until the history has been written so that they stay in order
+        if (!purple_conversation_get_data(conv, "line-message-queue")) {
+            purple_conversation_set_data(conv, "line-message-queue",
+                new std::vector<line::Message>());
+        }
+    }
+
+    replay->remaining += count;
+    replay->requested = replay->requested || requested;
+
+    // The first history of a conversation can often be served from the warm messages
+    if (!replay->fetching
+        && replay->pages.empty()
+        && !purple_conversation_get_data(conv, "line-end-seq")
+        && history_from_warm_messages(conv, replay))
+    {
+        return;
+    }
+
+    if (!replay->fetching)
+        history_fetch_page(conv, replay);
+}
+
+std::string PurpleLine::get_search_text(const line::Message &msg) {
+    std::string text;
+
+    if (msg.contentType == line::ContentType::NONE)
+        text = msg.text;
+
+    if (msg.__isset.location)
+        text += "\n" + msg.location.title + "\n" + msg.location.address;
+
+    return text;
+}
+
+void PurpleLine::index_message(const std::string &box, const line::Message &msg) {
+    search_index.add(box, MessageLog::message_seq(msg), get_search_text(msg));
+}
+
+bool PurpleLine::history_from_warm_messages(PurpleConversation *conv, HistoryReplay *replay) {
+    std::vector<line::Message> msgs;
+
+    if (!warm_messages.recent(purple_conversation_get_name(conv), replay->remaining, msgs))
+        return false;
+
+    // Further history is fetched starting from the oldest message, so it must have a seq
+    int64_t end_seq;
+
+    try {
+        end_seq = std::stoll(msgs.front().contentMetadata.at("seq"));
+    } catch (...) {
+        return false;
+    }
+
+    purple_debug_info("line", "History from warm messages: count=%d\n", replay->remaining);
+
+    purple_conversation_set_data(conv, "line-end-seq", new int64_t(end_seq));
+
+    replay->remaining = 0;
+    replay->pages.push_back(std::move(msgs));
+
+    if (!replay->idle_handle)
+        replay->idle_handle = g_idle_add(history_replay_cb, (gpointer)replay);
+
+    return true;
+}
+
+void PurpleLine::history_fetch_page(PurpleConversation *conv, HistoryReplay *replay) {
     PurpleConversationType type = conv->type;
     std::string name(purple_conversation_get_name(conv));
 
     int64_t end_seq = -1;
+    int count = 0;
 
-    int64_t *end_seq_p = (int64_t *)purple_conversation_get_data(conv, "line-end-seq");
-    if (end_seq_p)
-        end_seq = *end_seq_p;
+    // Read as much as possible from the message log, and only ask the server to fill the gap
+    while (replay->remaining > 0) {
+        int64_t *end_seq_p = (int64_t *)purple_conversation_get_data(conv, "line-end-seq");
+        end_seq = end_seq_p ? *end_seq_p : -1;
+
+        count = (replay->remaining < HISTORY_PAGE_SIZE) ? replay->remaining : HISTORY_PAGE_SIZE;
+
+        if (end_seq == -1)
+            break;
+
+        std::vector<line::Message> msgs;
+        bool at_start = message_log.previous(name, end_seq, count, msgs);
+
+        if (msgs.empty() && !at_start)
+            break;
+
+        purple_debug_info("line",
+            "History from message log: end_seq=%" G_GINT64_FORMAT " , count=%d\n",
+            end_seq, (int)msgs.size());
+
+        history_page_received(conv, replay, msgs, at_start);
+    }
+
+    if (replay->remaining <= 0) {
+        if (!replay->idle_handle)
+            replay->idle_handle = g_idle_add(history_replay_cb, (gpointer)replay);
+
+        return;
+    }
 
     purple_debug_info("line",
         "Fetching history: end_seq=%" G_GINT64_FORMAT " , count=%d, requested=%d\n",
-        end_seq, count, requested);
+        end_seq, count, replay->requested);
 
     if (end_seq != -1)
         c_out->send_getPreviousMessages(name, end_seq - 1, count);
     else
         c_out->send_getRecentMessages(name, count);
 
-    c_out->send([this, requested, type, name, end_seq]() {
-        int64_t new_end_seq = end_seq;
+    replay->fetching = true;
 
-        std::vector<line::Message> recent_msgs;
+    auto fetched = std::make_shared<std::vector<line::Message>>();
 
-        if (end_seq != -1)
-            c_out->recv_getPreviousMessages(recent_msgs);
-        else
-            c_out->recv_getRecentMessages(recent_msgs);
+    c_out->send(
+        [end_seq, fetched](int, line::TalkServiceClient &client) {
+            if (end_seq != -1)
+                client.recv_getPreviousMessages(*fetched);
+            else
+                client.recv_getRecentMessages(*fetched);
+        },
+        [this, type, name, end_seq, count, fetched]() {
+            std::vector<line::Message> &recent_msgs = *fetched;
 
-        PurpleConversation *conv = purple_find_conversation_with_account(type, name.c_str(), acct);
-        if (!conv)
-            return; // Conversation died while fetching messages
+            // Stop when the server runs out of history
+            bool at_start = ((int)recent_msgs.size() < count);
 
-        auto *queue = (std::vector<line::Message> *)
-            purple_conversation_get_data(conv, "line-message-queue");
+            message_log.add_history(name, end_seq, recent_msgs, at_start);
 
-        purple_conversation_set_data(conv, "line-message-queue", nullptr);
+            for (line::Message &msg: recent_msgs)
+                index_message(name, msg);
 
-        // Find least seq value from messages for future history queries
-        for (line::Message &msg: recent_msgs) {
-            if (msg.contentMetadata.count("seq")) {
-                try {
-                    int64_t seq = std::stoll(msg.contentMetadata["seq"]);
+            // The most recent messages are an unbroken tail, so they can seed the warm messages
+            if (end_seq == -1)
+                warm_messages.reset(name, recent_msgs);
 
-                    if (new_end_seq == -1 || seq < new_end_seq)
-                        new_end_seq = seq;
-                } catch (...) { /* ignore parse error */ }
-            }
-        }
+            PurpleConversation *conv =
+                purple_find_conversation_with_account(type, name.c_str(), acct);
+            if (!conv)
+                return; // Conversation died while fetching messages
 
-        if (queue) {
-            // If there's a message queue, remove any already-queued messages in the recent message
-            // list to prevent them showing up twice.
-
-            recent_msgs.erase(
-                std::remove_if(
-                    recent_msgs.begin(),
-                    recent_msgs.end(),
-                    [&queue](line::Message &rm) {
-                        auto r = find_if(
-                            queue->begin(),
-                            queue->end(),
-                            [&rm](line::Message &qm) { return qm.id == rm.id; });
-
-                        return (r != queue->end());
-                    }),
-                recent_msgs.end());
-        }
+            auto replay =
+                (HistoryReplay *)purple_conversation_get_data(conv, "line-history-replay");
+            if (!replay)
+                return;
 
-        if (recent_msgs.size()) {
-            purple_conversation_write(
-                conv,
-                "",
-                "<strong>Message history</strong>",
-                (PurpleMessageFlags)PURPLE_MESSAGE_RAW,
-                time(NULL));
+            replay->fetching = false;
+
+            history_page_received(conv, replay, recent_msgs, at_start);
+
+            // Fetch the next page while this one is being written
+            if (replay->remaining > 0)
+                history_fetch_page(conv, replay);
+
+            if (!replay->idle_handle)
+                replay->idle_handle = g_idle_add(history_replay_cb, (gpointer)replay);
+        });
+}
+
+// Queues a page of history, newest first, for writing and moves the history position past it
+void PurpleLine::history_page_received(PurpleConversation *conv, HistoryReplay *replay,
+    std::vector<line::Message> &msgs, bool at_start)
+{
+    int64_t end_seq = -1;
+
+    int64_t *end_seq_p = (int64_t *)purple_conversation_get_data(conv, "line-end-seq");
+    if (end_seq_p)
+        end_seq = *end_seq_p;
+
+    int64_t new_end_seq = end_seq;
+
+    // Find least seq value from messages for future history queries
+    for (line::Message &msg: msgs) {
+        int64_t seq = MessageLog::message_seq(msg);
+
+        if (seq != -1 && (new_end_seq == -1 || seq < new_end_seq))
+            new_end_seq = seq;
+    }
+
+    if (end_seq_p)
+        delete end_seq_p;
+
+    purple_conversation_set_data(conv, "line-end-seq", new int64_t(new_end_seq));
+
+    // Stop if history can't be paged any further
+    if (at_start || new_end_seq == end_seq)
+        replay->remaining = 0;
+    else
+        replay->remaining -= (int)msgs.size();
+
+    auto *queue = (std::vector<line::Message> *)
+        purple_conversation_get_data(conv, "line-message-queue");
+
+    if (queue) {
+        // Remove any already-queued messages in the recent message list to prevent them
+        // showing up twice.
+
+        std::unordered_set<std::string> queued;
+        for (line::Message &qm: *queue)
+            queued.insert(qm.id);
+
+        msgs.erase(
+            std::remove_if(
+                msgs.begin(),
+                msgs.end(),
+                [&queued](line::Message &rm) { return queued.count(rm.id) > 0; }),
+            msgs.end());
+    }
+
+    if (msgs.size()) {
+        std::reverse(msgs.begin(), msgs.end());
+        replay->pages.push_back(std::move(msgs));
+    }
+}
+
+gboolean PurpleLine::history_replay_cb(gpointer data) {
+    HistoryReplay *replay = (HistoryReplay *)data;
+
+    return replay->parent->history_replay_step(replay) ? TRUE : FALSE;
+}
 
-            for (auto msgi = recent_msgs.rbegin(); msgi != recent_msgs.rend(); msgi++)
-                write_message(*msgi, true);
+// Writes fetched history until the time slice runs out. Returns true if there is more to write.
+bool PurpleLine::history_replay_step(HistoryReplay *replay) {
+    PurpleConversation *conv = replay->conv;
 
+    gint64 deadline = g_get_monotonic_time() + HISTORY_SLICE_USEC;
+
+    while (!replay->pages.empty()) {
+        std::vector<line::Message> &page = replay->pages.front();
+
+        if (replay->page_pos == 0) {
             purple_conversation_write(
                 conv,
                 "",
-                "<hr>",
+                "<strong>Message history</strong>",
                 (PurpleMessageFlags)PURPLE_MESSAGE_RAW,
                 time(NULL));
-        } else {
-            if (requested) {
-                // If history was requested by the user and there is none, let the user know
-
-                purple_conversation_write(
-                    conv,
-                    "",
-                    "<strong>No more history</strong>",
-                    (PurpleMessageFlags)PURPLE_MESSAGE_RAW,
-                    time(NULL));
-            }
         }
 
-        // If there's a message queue, play it back now
-        if (queue) {
-            for (line::Message &msg: *queue)
-                write_message(msg, false);
+        while (replay->page_pos < page.size()) {
+            write_message(page[replay->page_pos++], true);
 
-            delete queue;
+            if (g_get_monotonic_time() >= deadline)
+                return true;
         }
 
-        int64_t *end_seq_p = (int64_t *)purple_conversation_get_data(conv, "line-end-seq");
-        if (end_seq_p)
-            delete end_seq_p;
+        purple_conversation_write(
+            conv,
+            "",
+            "<hr>",
+            (PurpleMessageFlags)PURPLE_MESSAGE_RAW,
+            time(NULL));
 
-        purple_conversation_set_data(conv, "line-end-seq", new int64_t(new_end_seq));
+        replay->pages.pop_front();
+        replay->page_pos = 0;
+        replay->any_written = true;
+    }
 
-        purple_debug_info("line", "History done: new_end_seq=%" G_GINT64_FORMAT "\n", new_end_seq);
-    });
+    replay->idle_handle = 0;
+
+    // If more pages are on the way, the fetch callback starts writing again
+    if (!replay->fetching && replay->remaining <= 0)
+        history_replay_finish(replay);
+
+    return false;
 }
 
-void PurpleLine::signal_deleting_conversation(PurpleConversation *conv) {
-    if (purple_conversation_get_account(conv) != acct)
-        return;
+void PurpleLine::history_replay_finish(HistoryReplay *replay) {
+    PurpleConversation *conv = replay->conv;
+
+    if (!replay->any_written && replay->requested) {
+        // If history was requested by the user and there is none, let the user know
+
+        purple_conversation_write(
+            conv,
+            "",
+            "<strong>No more history</strong>",
+            (PurpleMessageFlags)PURPLE_MESSAGE_RAW,
+            time(NULL));
+    }
+
+    purple_conversation_set_data(conv, "line-history-replay", nullptr);
+    delete replay;
+
+    auto *queue = (std::vector<line::Message> *)
+        purple_conversation_get_data(conv, "line-message-queue");
+
+    purple_conversation_set_data(conv, "line-message-queue", nullptr);
+
+    // Play back messages that arrived during the replay
+    if (queue) {
+        for (line::Message &msg: *queue)
+            write_message(msg, false);
+
+        delete queue;
+    }
+
+    purple_debug_info("line", "History done\n");
+}
+
+void PurpleLine::history_replay_cancel(PurpleConversation *conv) {
+    auto replay = (HistoryReplay *)purple_conversation_get_data(conv, "line-history-replay");
+    if (replay) {
+        if (replay->idle_handle)
+            g_source_remove(replay->idle_handle);
+
+        purple_conversation_set_data(conv, "line-history-replay", nullptr);
+        delete replay;
+    }
 
     auto queue = (std::vector<line::Message> *)
         purple_conversation_get_data(conv, "line-message-queue");
 
     if (queue) {
         purple_conversation_set_data(conv, "line-message-queue", nullptr);
+
+        // Messages that arrived during the replay are only stored when they are played back.
+        // Store them now, or the next live message would be linked past them in the message log.
+        for (line::Message &msg: *queue) {
+            if (!recent_messages.contains(msg.id))
+                store_live_message(msg);
+        }
+
         delete queue;
     }
+}
+
+void PurpleLine::signal_deleting_conversation(PurpleConversation *conv) {
+    if (purple_conversation_get_account(conv) != acct)
+        return;
+
+    // Chat users are freed without chat-buddy-left signals
+    if (purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_IM)
+        conv_refs_remove(purple_conversation_get_name(conv));
+    else if (purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_CHAT)
+        conv_refs_remove_chat_users(PURPLE_CONV_CHAT(conv));
+
+    history_replay_cancel(conv);
 
     int64_t *end_seq_p = (int64_t *)purple_conversation_get_data(conv, "line-end-seq");
     if (end_seq_p) {
@@ -635,6 +1090,93 @@ void PurpleLine::signal_deleting_conversation(PurpleConversation *conv) {
     }
 }
 
+void PurpleLine::signal_chat_buddy_joined(PurpleConversation *conv, const char *name,
+    PurpleConvChatBuddyFlags, gboolean)
+{
+    if (purple_conversation_get_account(conv) != acct)
+        return;
+
+    conv_refs_add(name);
+
+    // Users without a buddy are shown by their alias in the chat, which libpurple only takes from
+    // buddies and otherwise sets to the MID. libpurple 2 has no call for changing it, and the
+    // signal is emitted before the UI sees the user, so replace it here.
+    if (!purple_find_buddy(acct, name)) {
+        ContactPtr contact = store.get_contact(name);
+
+        PurpleConvChatBuddy *cb = purple_conv_chat_cb_find(PURPLE_CONV_CHAT(conv), name);
+
+        if (contact && cb && !contact->displayName.empty()
+            && (!cb->alias || purple_strequal(cb->alias, name)))
+        {
+            g_free(cb->alias);
+            cb->alias = g_strdup(contact->displayName.c_str());
+
+            g_free(cb->alias_key);
+            cb->alias_key = g_utf8_collate_key(cb->alias, -1);
+        }
+    }
+}
+
+void PurpleLine::signal_chat_buddy_left(PurpleConversation *conv, const char *name, const char *)
+{
+    if (purple_conversation_get_account(conv) != acct)
+        return;
+
+    conv_refs_remove(name);
+}
+
+// Counts conversations that were left open from a previous connection
+void PurpleLine::conv_refs_build() {
+    conv_refs.clear();
+
+    for (GList *convs = purple_get_conversations(); convs; convs = g_list_next(convs)) {
+        PurpleConversation *conv = (PurpleConversation *)convs->data;
+
+        if (purple_conversation_get_account(conv) != acct)
+            continue;
+
+        if (purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_IM) {
+            conv_refs_add(purple_conversation_get_name(conv));
+        } else if (purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_CHAT) {
+            for (GList *buddies = purple_conv_chat_get_users(PURPLE_CONV_CHAT(conv));
+                buddies;
+                buddies = g_list_next(buddies))
+            {
+                PurpleConvChatBuddy *buddy = (PurpleConvChatBuddy *)buddies->data;
+
+                conv_refs_add(purple_conv_chat_cb_get_name(buddy));
+            }
+        }
+    }
+}
+
+void PurpleLine::conv_refs_add(std::string uid) {
+    conv_refs[uid]++;
+}
+
+void PurpleLine::conv_refs_remove(std::string uid) {
+    auto i = conv_refs.find(uid);
+    if (i == conv_refs.end())
+        return;
+
+    if (--i->second <= 0)
+        conv_refs.erase(i);
+}
+
+// Must be called before chat users are cleared, as purple_conv_chat_clear_users doesn't emit
+// chat-buddy-left
+void PurpleLine::conv_refs_remove_chat_users(PurpleConvChat *chat) {
+    for (GList *buddies = purple_conv_chat_get_users(chat);
+        buddies;
+        buddies = g_list_next(buddies))
+    {
+        PurpleConvChatBuddy *buddy = (PurpleConvChatBuddy *)buddies->data;
+
+        conv_refs_remove(purple_conv_chat_cb_get_name(buddy));
+    }
+}
+
 void PurpleLine::notify_error(std::string msg) {
     purple_notify_error(
         (void *)conn,
@@ -2,6 +2,8 @@
 
 #include <string>
 #include <deque>
+#include <map>
+#include <unordered_map>
 
 #include <cmds.h>
 #include <debug.h>
@@ -9,9 +11,20 @@
 #include <prpl.h>
 
 #include "constants.hpp"
+#include "contactstore.hpp"
+#include "dedupset.hpp"
+#include "markup.hpp"
+#include "messagelog.hpp"
+#include "searchindex.hpp"
+#include "messagering.hpp"
+#include "stats.hpp"
 #include "thriftclient.hpp"
 #include "httpclient.hpp"
+#include "iconfetcher.hpp"
+#include "uploadscheduler.hpp"
+#include "workerpool.hpp"
 #include "poller.hpp"
+#include "previewcache.hpp"
 #include "pinverifier.hpp"
 
 class ThriftClient;
@@ -42,8 +55,6 @@ enum class ChatType {
     GROUP_INVITE = 3,
 };
 
-std::string markup_escape(std::string const &text);
-
 std::string markup_unescape(std::string const &markup);
 
 std::string url_encode(std::string const &str);
@@ -61,17 +72,62 @@ class PurpleLine {
         }
     };
 
+    // History being fetched and written into a conversation. Large requests are fetched in pages
+    // and written a few messages at a time from an idle callback so that the UI stays responsive.
+    struct HistoryReplay {
+        PurpleLine *parent;
+        PurpleConversation *conv;
+
+        int remaining; // messages still to fetch
+        bool requested;
+        bool fetching;
+        bool any_written;
+
+        // Fetched pages waiting to be written, oldest message first within each page
+        std::deque<std::vector<line::Message>> pages;
+        size_t page_pos;
+
+        guint idle_handle;
+    };
+
+    static const int HISTORY_PAGE_SIZE = 50;
+    static const gint64 HISTORY_SLICE_USEC = 10000;
+    static const int WARM_MESSAGES_PER_BOX = 50;
+    static const int SEARCH_RESULTS_MAX = 20;
+    static const int MESSAGE_BOX_PAGE_SIZE = 100;
+
+    // Hashes of buddy details last pushed into libpurple, used to skip updates that wouldn't
+    // change anything
+    struct BuddyFingerprint {
+        size_t alias;
+        size_t status;
+        bool official;
+    };
+
     static std::map<ChatType, std::string> chat_type_to_string;
 
     PurpleConnection *conn;
     PurpleAccount *acct;
 
+    // Declared before the clients that record into it
+    Stats stats;
+
+    // Periodic snapshots of stats appended to stats_path, if enabled
+    guint stats_timeout;
+    std::string stats_path;
+
     boost::shared_ptr<ThriftClient> c_out;
 
     HTTPClient http;
 
+    IconFetcher icons;
+
     // Remove if libpurple HTTP ever gets support for binary request bodies
-    LineHttpTransport os_http;
+    UploadScheduler uploads;
+
+    WorkerPool workers;
+
+    PreviewCache previews;
 
     friend class Poller;
     Poller poller;
@@ -81,20 +137,40 @@ class PurpleLine {
 
     int next_purple_id;
 
-    std::deque<std::string> recent_messages;
+    DedupSet recent_messages;
+
+    // Recent messages of each message box for opening conversations without a history fetch
+    MessageRing warm_messages;
+
+    // Messages stored on disk for serving history
+    MessageLog message_log;
+    SearchIndex search_index;
 
     std::vector<std::string> temp_files;
 
     line::Profile profile;
     line::Contact profile_contact; // contains some fields from profile
     line::Contact no_contact; // empty object
-    std::map<std::string, line::Group> groups;
-    std::map<std::string, line::Room> rooms;
-    std::map<std::string, line::Contact> contacts;
+    ContactStore store;
+
+    // Chats of this account on the buddy list by type and ID. Chats with an unknown type are
+    // indexed under ChatType::ANY.
+    std::map<ChatType, std::unordered_map<std::string, PurpleChat *>> chat_index;
+
+    // Number of open conversations each user is in, either as the other party of an IM or as a
+    // chat participant
+    std::unordered_map<std::string, int> conv_refs;
+
+    std::unordered_map<std::string, BuddyFingerprint> buddy_fingerprints;
+    int stat_buddy_updates_applied;
+    int stat_buddy_updates_skipped;
 
     void *pin_ui_handle;
     guint pin_timeout;
 
+    // Measurement harness in bench/chat_bench.cpp
+    friend struct ChatBench;
+
 public:
 
     PurpleLine(PurpleConnection *conn, PurpleAccount *acct);
@@ -119,6 +195,10 @@ public:
 
     PurpleCmdRet cmd_open(PurpleConversation *conv,
         const gchar *, gchar **args, gchar **error, void *);
+    PurpleCmdRet cmd_search(PurpleConversation *conv,
+        const gchar *, gchar **args, gchar **error, void *);
+    PurpleCmdRet cmd_linestats(PurpleConversation *conv,
+        const gchar *, gchar **args, gchar **error, void *);
 
 private:
 
@@ -126,36 +206,63 @@ private:
     void disconnect_signals();
 
     std::string get_tmp_dir(bool create=false);
+    std::string get_data_dir(std::string name);
 
     std::string conv_attachment_add(PurpleConversation *conv,
         line::ContentType::type type, std::string id);
     Attachment *conv_attachment_get(PurpleConversation *conv, std::string token);
 
     void write_message(line::Message &msg, bool replay);
+    void store_live_message(const line::Message &msg);
     void write_message(PurpleConversation *conv, std::string &from, std::string &text,
         time_t mtime, int flags);
 
-    std::string get_room_display_name(line::Room &room);
-    void set_chat_participants(PurpleConvChat *chat, line::Room &room);
-    void set_chat_participants(PurpleConvChat *chat, line::Group &group);
-
-    line::Contact &get_up_to_date_contact(line::Contact &c);
+    std::string get_room_display_name(const RoomInfo &room);
+    void set_chat_participants(PurpleConvChat *chat, const RoomInfo &room);
+    void set_chat_participants(PurpleConvChat *chat, const GroupInfo &group);
+    void update_chat_participants(PurpleConvChat *chat,
+        std::vector<std::pair<std::string, int>> &participants);
 
     int send_message(std::string to, const char *markup);
     void send_message(
         line::Message &msg,
         std::function<void(line::Message &msg)> callback=std::function<void(line::Message &)>());
-    void upload_media(std::string message_id, std::string type, std::string data);
-    void push_recent_message(std::string id);
+    void send_image(std::string to, PurpleStoredImage *img);
+    void upload_media(std::string to, std::string message_id, std::string type,
+        std::string mime_type, LineHttpTransport::BodyPart data);
 
+    void signal_blist_node_added(PurpleBlistNode *node);
     void signal_blist_node_removed(PurpleBlistNode *node);
     void signal_conversation_created(PurpleConversation *conv);
     void signal_deleting_conversation(PurpleConversation *conv);
+    void signal_chat_buddy_joined(PurpleConversation *conv, const char *name,
+        PurpleConvChatBuddyFlags flags, gboolean new_arrival);
+    void signal_chat_buddy_left(PurpleConversation *conv, const char *name, const char *reason);
+
+    void conv_refs_build();
+    void conv_refs_add(std::string uid);
+    void conv_refs_remove(std::string uid);
+    void conv_refs_remove_chat_users(PurpleConvChat *chat);
 
     void fetch_conversation_history(PurpleConversation *conv, int count, bool requested);
+    static std::string get_search_text(const line::Message &msg);
+    void index_message(const std::string &box, const line::Message &msg);
+
+    bool history_from_warm_messages(PurpleConversation *conv, HistoryReplay *replay);
+    void history_fetch_page(PurpleConversation *conv, HistoryReplay *replay);
+    void history_page_received(PurpleConversation *conv, HistoryReplay *replay,
+        std::vector<line::Message> &msgs, bool at_start);
+    static gboolean history_replay_cb(gpointer data);
+    bool history_replay_step(HistoryReplay *replay);
+    void history_replay_finish(HistoryReplay *replay);
+    void history_replay_cancel(PurpleConversation *conv);
 
     void notify_error(std::string msg);
 
+    std::string stats_report();
+    void stats_start_snapshots();
+    int stats_timeout_cb();
+
     // sync
 
 private:
@@ -171,7 +278,9 @@ private:
     void get_contacts();
     void get_groups();
     void get_rooms();
-    void update_rooms(line::MessageBoxWrapUpList wrap_up_list);
+    void get_rooms_page(int start, std::shared_ptr<std::set<std::string>> stale_ids);
+    void update_rooms(std::vector<line::Room> &rooms, std::set<std::string> &stale_ids);
+    void remove_stale_rooms(std::set<std::string> &stale_ids);
     void get_group_invites();
 
     void login_done();
@@ -191,13 +300,20 @@ private:
     PurpleGroup *blist_ensure_group(std::string group_name, bool temporary=false);
     PurpleBuddy *blist_ensure_buddy(std::string uid, bool temporary=false);
     void blist_update_buddy(std::string uid, bool temporary=false);
+    void blist_update_buddies(std::vector<std::string> uids, bool temporary=false);
+    void blist_materialize_buddy(std::string uid);
     PurpleBuddy *blist_update_buddy(line::Contact &contact, bool temporary=false);
+    PurpleBuddy *blist_update_buddy(ContactPtr contact, bool temporary=false);
+    BuddyFingerprint blist_get_buddy_fingerprint(PurpleBuddy *buddy);
     bool blist_is_buddy_in_any_conversation(std::string uid, PurpleConvChat *ignore_chat);
     void blist_remove_buddy(std::string uid,
         bool temporary_only=false, PurpleConvChat *ignore_chat=nullptr);
 
     std::set<PurpleChat *> blist_find_chats_by_type(ChatType type);
     PurpleChat *blist_find_chat(std::string id, ChatType type);
+    void blist_index_chats();
+    void blist_index_chat_add(PurpleChat *chat);
+    void blist_index_chat_remove(PurpleChat *chat);
     PurpleChat *blist_ensure_chat(std::string id, ChatType type);
     void blist_update_chat(std::string id, ChatType type);
     PurpleChat *blist_update_chat(line::Group &group);
@@ -215,6 +331,7 @@ public:
     void chat_leave(int id);
     int chat_send(int id, const char *message, PurpleMessageFlags flags);
     PurpleChat *find_blist_chat(const char *name);
+    char *get_cb_real_name(int id, const char *who);
 
 private:
 
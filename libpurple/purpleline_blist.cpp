@@ -71,102 +71,169 @@ void PurpleLine::blist_update_buddy(std::string uid, bool temporary) {
     });
 }
 
-// Updates buddy details such as alias, icon, status message
+// Same as above for many users with a single request
+void PurpleLine::blist_update_buddies(std::vector<std::string> uids, bool temporary) {
+    if (uids.empty())
+        return;
+
+    for (std::string &uid: uids)
+        blist_ensure_buddy(uid.c_str(), temporary);
+
+    c_out->send_getContacts(uids);
+    c_out->send([this, temporary]{
+        std::vector<line::Contact> contacts;
+        c_out->recv_getContacts(contacts);
+
+        for (line::Contact &contact: contacts) {
+            if (contact.__isset.mid)
+                blist_update_buddy(contact, temporary);
+        }
+    });
+}
+
+// Creates a temporary buddy for a member of a large chat, which don't get buddies until they are
+// needed
+void PurpleLine::blist_materialize_buddy(std::string uid) {
+    if (uid == profile.mid || purple_find_buddy(acct, uid.c_str()))
+        return;
+
+    ContactPtr contact = store.get_contact(uid);
+    if (contact)
+        blist_update_buddy(contact, true);
+    else
+        blist_update_buddy(uid, true);
+}
+
 PurpleBuddy *PurpleLine::blist_update_buddy(line::Contact &contact, bool temporary) {
-    contacts[contact.mid] = contact;
+    return blist_update_buddy(store.update_contact(contact), temporary);
+}
+
+// Updates buddy details such as alias, icon, status message
+PurpleBuddy *PurpleLine::blist_update_buddy(ContactPtr contact, bool temporary) {
+    std::string uid = store.mid(contact->mid);
 
     if (!temporary
-        && (contact.status == line::ContactStatus::FRIEND_BLOCKED
-            || contact.status == line::ContactStatus::RECOMMEND_BLOCKED
-            || contact.status == line::ContactStatus::DELETED
-            || contact.status == line::ContactStatus::DELETED_BLOCKED))
+        && (contact->status == line::ContactStatus::FRIEND_BLOCKED
+            || contact->status == line::ContactStatus::RECOMMEND_BLOCKED
+            || contact->status == line::ContactStatus::DELETED
+            || contact->status == line::ContactStatus::DELETED_BLOCKED))
     {
-        blist_remove_buddy(contact.mid, false);
+        blist_remove_buddy(uid, false);
         return nullptr;
     }
 
-    PurpleBuddy *buddy = blist_ensure_buddy(contact.mid.c_str(), temporary);
+    PurpleBuddy *buddy = blist_ensure_buddy(uid, temporary);
     if (!buddy) {
-        purple_debug_warning("line", "Tried to update a non-existent buddy %s\n",
-            contact.mid.c_str());
+        purple_debug_warning("line", "Tried to update a non-existent buddy %s\n", uid.c_str());
         return nullptr;
     }
 
+    // Only push details that have changed, as every call below fires signals, redraws the buddy
+    // list and schedules a blist.xml save
+
+    std::hash<std::string> hash;
+
+    auto fp_iter = buddy_fingerprints.find(uid);
+    BuddyFingerprint fp = (fp_iter != buddy_fingerprints.end())
+        ? fp_iter->second
+        : blist_get_buddy_fingerprint(buddy);
+
+    int applied = 0, skipped = 0;
+
     // Update display name
-    purple_blist_alias_buddy(buddy, contact.displayName.c_str());
+    size_t alias = hash(contact->displayName);
+    if (alias != fp.alias) {
+        purple_blist_alias_buddy(buddy, contact->displayName.c_str());
+        fp.alias = alias;
+        applied++;
+    } else {
+        skipped++;
+    }
 
     // Update buddy icon if necessary
-    if (contact.picturePath != "") {
-        std::string pic_path = contact.picturePath.substr(1) + "/preview";
-        const char *current_pic_path = purple_buddy_icons_get_checksum_for_user(buddy);
-        if (!current_pic_path || std::string(current_pic_path) != pic_path) {
-            std::string uid = contact.mid;
-
-            http.request(LINE_OS_URL + pic_path, HTTPFlag::AUTH,
-                [this, uid, pic_path](int status, const guchar *data, gsize len)
-            {
-                if (status != 200 || !data)
-                    return;
-
-                purple_buddy_icons_set_for_user(
-                    acct,
-                    uid.c_str(),
-                    g_memdup(data, len),
-                    len,
-                    pic_path.c_str());
-            });
-        }
+    if (contact->picturePath != "") {
+        icons.fetch(uid, contact->picturePath.substr(1) + "/preview");
     } else {
         // TODO: delete icon if any
     }
 
     // Set actual friends as available and temporary friends as temporary. Also set status text.
-    purple_prpl_got_user_status(
-        acct,
-        contact.mid.c_str(),
-        PURPLE_BLIST_NODE_HAS_FLAG(buddy, PURPLE_BLIST_NODE_FLAG_NO_SAVE)
-            ? "temporary"
-            : purple_primitive_get_id_from_type(PURPLE_STATUS_AVAILABLE),
-        "message", contact.statusMessage.c_str(),
-        nullptr);
-
-    if (contact.attributes & 32)
-        purple_blist_node_set_bool(PURPLE_BLIST_NODE(buddy), "official_account", TRUE);
-    else
-        purple_blist_node_remove_setting(PURPLE_BLIST_NODE(buddy), "official_account");
+    std::string status_id = PURPLE_BLIST_NODE_HAS_FLAG(buddy, PURPLE_BLIST_NODE_FLAG_NO_SAVE)
+        ? "temporary"
+        : purple_primitive_get_id_from_type(PURPLE_STATUS_AVAILABLE);
+
+    size_t status = hash(status_id + "\n" + contact->statusMessage);
+    if (status != fp.status) {
+        purple_prpl_got_user_status(
+            acct,
+            uid.c_str(),
+            status_id.c_str(),
+            "message", contact->statusMessage.c_str(),
+            nullptr);
+
+        fp.status = status;
+        applied++;
+    } else {
+        skipped++;
+    }
+
+    bool official = (contact->attributes & 32) != 0;
+    if (official != fp.official) {
+        if (official)
+            purple_blist_node_set_bool(PURPLE_BLIST_NODE(buddy), "official_account", TRUE);
+        else
+            purple_blist_node_remove_setting(PURPLE_BLIST_NODE(buddy), "official_account");
+
+        fp.official = official;
+        applied++;
+    } else {
+        skipped++;
+    }
+
+    buddy_fingerprints[uid] = fp;
+
+    stat_buddy_updates_applied += applied;
+    stat_buddy_updates_skipped += skipped;
 
     return buddy;
 }
 
+// Fingerprints the details a buddy currently has in libpurple. Used for buddies that haven't been
+// updated during this connection, so that e.g. aliases saved in blist.xml aren't set again.
+PurpleLine::BuddyFingerprint PurpleLine::blist_get_buddy_fingerprint(PurpleBuddy *buddy) {
+    std::hash<std::string> hash;
+
+    BuddyFingerprint fp;
+
+    const char *alias = purple_buddy_get_local_buddy_alias(buddy);
+    fp.alias = hash(alias ? alias : "");
+
+    PurpleStatus *status = purple_presence_get_active_status(purple_buddy_get_presence(buddy));
+    const char *status_id = status ? purple_status_get_id(status) : nullptr;
+    const char *message = status ? purple_status_get_attr_string(status, "message") : nullptr;
+
+    fp.status = status_id
+        ? hash(std::string(status_id) + "\n" + (message ? message : ""))
+        : 0;
+
+    fp.official = purple_blist_node_get_bool(PURPLE_BLIST_NODE(buddy), "official_account");
+
+    return fp;
+}
+
 bool PurpleLine::blist_is_buddy_in_any_conversation(std::string uid,
     PurpleConvChat *ignore_chat)
 {
-    for (GList * convs = purple_get_conversations();
-        convs;
-        convs = g_list_next(convs))
-    {
-        PurpleConversation *conv = (PurpleConversation *)convs->data;
-
-        if (purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_IM) {
-            if (uid == purple_conversation_get_name(conv))
-                return true;
-        } else if (purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_CHAT) {
-            if (PURPLE_CONV_CHAT(conv) == ignore_chat)
-                continue;
-
-            for (GList *buddies = purple_conv_chat_get_users(PURPLE_CONV_CHAT(conv));
-                buddies;
-                buddies = g_list_next(buddies))
-            {
-                PurpleConvChatBuddy *buddy = (PurpleConvChatBuddy *)buddies->data;
-
-                if (uid == purple_conv_chat_cb_get_name(buddy))
-                    return true;
-            }
-        }
-    }
+    auto i = conv_refs.find(uid);
+    if (i == conv_refs.end())
+        return false;
+
+    int refs = i->second;
+
+    if (ignore_chat && purple_conv_chat_find_user(ignore_chat, uid.c_str()))
+        refs--;
 
-    return false;
+    return refs > 0;
 }
 
 void PurpleLine::blist_remove_buddy(std::string uid,
@@ -204,6 +271,8 @@ void PurpleLine::blist_remove_buddy(std::string uid,
             "temporary",
             "message", purple_status_get_attr_string(status, "message"),
             nullptr);
+
+        buddy_fingerprints.erase(uid);
     } else {
         // Otherwise, delete them.
 
@@ -212,29 +281,67 @@ void PurpleLine::blist_remove_buddy(std::string uid,
 }
 
 std::set<PurpleChat *> PurpleLine::blist_find_chats_by_type(ChatType type) {
-    std::string type_string = chat_type_to_string[type];
+    std::set<PurpleChat *> results;
 
-    return blist_find<PurpleChat>([type_string](PurpleChat *chat) {
-        GHashTable *components = purple_chat_get_components(chat);
+    for (auto &p: chat_index[type])
+        results.insert(p.second);
 
-        return type_string == (char *)g_hash_table_lookup(components, "type");
-    });
+    return results;
 }
 
 // Maybe put into function below
 PurpleChat *PurpleLine::blist_find_chat(std::string id, ChatType type) {
-    std::string type_string = chat_type_to_string[type];
+    if (type == ChatType::ANY) {
+        for (auto &p: chat_index) {
+            auto i = p.second.find(id);
+            if (i != p.second.end())
+                return i->second;
+        }
 
-    std::set<PurpleChat *> chats = blist_find<PurpleChat>([type, type_string, id](PurpleChat *chat){
-        GHashTable *components = purple_chat_get_components(chat);
+        return nullptr;
+    }
 
-        return
-            (type == ChatType::ANY
-                || type_string == (char *)g_hash_table_lookup(components, "type"))
-            && id == (char *)g_hash_table_lookup(components, "id");
-    });
+    auto &chats = chat_index[type];
+
+    auto i = chats.find(id);
+    return (i == chats.end()) ? nullptr : i->second;
+}
+
+// Builds the chat index from the buddy list. After this the index is kept up to date by the
+// blist-node-added and blist-node-removed signals.
+void PurpleLine::blist_index_chats() {
+    chat_index.clear();
+
+    for (PurpleChat *chat: blist_find<PurpleChat>())
+        blist_index_chat_add(chat);
+}
+
+void PurpleLine::blist_index_chat_add(PurpleChat *chat) {
+    GHashTable *components = purple_chat_get_components(chat);
+
+    char *id_ptr = (char *)g_hash_table_lookup(components, "id");
+    if (!id_ptr)
+        return;
+
+    ChatType type = get_chat_type((char *)g_hash_table_lookup(components, "type"));
+
+    chat_index[type][id_ptr] = chat;
+}
+
+void PurpleLine::blist_index_chat_remove(PurpleChat *chat) {
+    GHashTable *components = purple_chat_get_components(chat);
+
+    char *id_ptr = (char *)g_hash_table_lookup(components, "id");
+    if (!id_ptr)
+        return;
+
+    ChatType type = get_chat_type((char *)g_hash_table_lookup(components, "type"));
+
+    auto &chats = chat_index[type];
 
-    return chats.empty() ? nullptr : *chats.begin();
+    auto i = chats.find(id_ptr);
+    if (i != chats.end() && i->second == chat)
+        chats.erase(i);
 }
 
 PurpleChat *PurpleLine::blist_ensure_chat(std::string id, ChatType type) {
@@ -282,7 +389,7 @@ void PurpleLine::blist_update_chat(std::string id, ChatType type) {
 }
 
 PurpleChat *PurpleLine::blist_update_chat(line::Group &group) {
-    groups[group.id] = group;
+    const GroupInfo &info = store.update_group(group);
 
     PurpleChat *chat = blist_ensure_chat(group.id, ChatType::GROUP);
 
@@ -296,17 +403,17 @@ PurpleChat *PurpleLine::blist_update_chat(line::Group &group) {
         acct);
 
     if (conv)
-        set_chat_participants(PURPLE_CONV_CHAT(conv), group);
+        set_chat_participants(PURPLE_CONV_CHAT(conv), info);
 
     return chat;
 }
 
 PurpleChat *PurpleLine::blist_update_chat(line::Room &room) {
-    rooms[room.mid] = room;
+    const RoomInfo &info = store.update_room(room);
 
     PurpleChat *chat = blist_ensure_chat(room.mid, ChatType::ROOM);
 
-    purple_blist_alias_chat(chat, get_room_display_name(room).c_str());
+    purple_blist_alias_chat(chat, get_room_display_name(info).c_str());
 
     // If a conversation is somehow already open, set its members
 
@@ -316,7 +423,7 @@ PurpleChat *PurpleLine::blist_update_chat(line::Room &room) {
         acct);
 
     if (conv)
-        set_chat_participants(PURPLE_CONV_CHAT(conv), room);
+        set_chat_participants(PURPLE_CONV_CHAT(conv), info);
 
     return chat;
 }
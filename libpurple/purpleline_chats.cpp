@@ -21,12 +21,13 @@ ChatType PurpleLine::get_chat_type(const char *type_ptr) {
     return ChatType::ANY; // Invalid
 }
 
-std::string PurpleLine::get_room_display_name(line::Room &room) {
-    std::vector<line::Contact *> rcontacts;
+std::string PurpleLine::get_room_display_name(const RoomInfo &room) {
+    std::vector<ContactPtr> rcontacts;
 
-    for (line::Contact &rc: room.contacts) {
-        if (contacts.count(rc.mid) == 1)
-            rcontacts.push_back(&contacts[rc.mid]);
+    for (MidId id: room.contacts) {
+        ContactPtr contact = store.get_contact(id);
+        if (contact)
+            rcontacts.push_back(contact);
     }
 
     if (rcontacts.size() == 0)
@@ -100,64 +101,117 @@ void PurpleLine::handle_group_invite(
     }
 }
 
-void PurpleLine::set_chat_participants(PurpleConvChat *chat, line::Group &group) {
-    purple_conv_chat_clear_users(chat);
+void PurpleLine::set_chat_participants(PurpleConvChat *chat, const GroupInfo &group) {
+    std::vector<std::pair<std::string, int>> participants;
+    participants.reserve(group.members.size() + group.invitee.size());
 
-    GList *users = NULL, *flags = NULL;
+    for (MidId id: group.members) {
+        participants.push_back(std::make_pair(store.mid(id),
+            (id == group.creator) ? PURPLE_CBFLAGS_FOUNDER : PURPLE_CBFLAGS_NONE));
+    }
+
+    for (MidId id: group.invitee)
+        participants.push_back(std::make_pair(store.mid(id), PURPLE_CBFLAGS_AWAY));
+
+    update_chat_participants(chat, participants);
+}
+
+void PurpleLine::set_chat_participants(PurpleConvChat *chat, const RoomInfo &room) {
+    std::vector<std::pair<std::string, int>> participants;
+    participants.reserve(room.contacts.size() + 1);
+
+    for (MidId id: room.contacts)
+        participants.push_back(std::make_pair(store.mid(id), PURPLE_CBFLAGS_NONE));
+
+    // Room contact lists don't contain self, so add for consistency
+    participants.push_back(std::make_pair(profile.mid, PURPLE_CBFLAGS_NONE));
+
+    update_chat_participants(chat, participants);
+}
+
+// Brings the user list of a chat up to date with the given users and flags. Only users who have
+// joined, left or changed are touched, so that updates to large groups stay cheap.
+void PurpleLine::update_chat_participants(PurpleConvChat *chat,
+    std::vector<std::pair<std::string, int>> &participants)
+{
+    std::unordered_map<std::string, int> wanted(participants.begin(), participants.end());
+
+    GList *current = purple_conv_chat_get_users(chat);
 
-    for (line::Contact &c: group.members) {
-        line::Contact &contact = get_up_to_date_contact(c);
+    // Chat users are freed while they are being removed, so keep copies of the names
+    std::vector<std::string> removed;
 
-        blist_update_buddy(contact, true);
+    for (GList *l = current; l; l = l->next) {
+        const char *name = purple_conv_chat_cb_get_name((PurpleConvChatBuddy *)l->data);
 
-        int cbflags = 0;
+        auto i = wanted.find(name);
 
-        if (contact.mid == group.creator.mid)
-            cbflags |= PURPLE_CBFLAGS_FOUNDER;
+        if (i == wanted.end()) {
+            removed.push_back(name);
+        } else {
+            if ((int)purple_conv_chat_user_get_flags(chat, name) != i->second)
+                purple_conv_chat_user_set_flags(chat, name, (PurpleConvChatBuddyFlags)i->second);
 
-        users = g_list_prepend(users, (gpointer)contact.mid.c_str());
-        flags = g_list_prepend(flags, GINT_TO_POINTER(cbflags));
+            wanted.erase(i);
+        }
     }
 
-    for (line::Contact &c: group.invitee) {
-        line::Contact &contact = get_up_to_date_contact(c);
+    if (!removed.empty()) {
+        GList *users = NULL;
+
+        for (std::string &uid: removed)
+            users = g_list_prepend(users, (gpointer)uid.c_str());
 
-        blist_update_buddy(contact, true);
+        purple_conv_chat_remove_users(chat, users, NULL);
 
-        users = g_list_prepend(users, (gpointer)contact.mid.c_str());
-        flags = g_list_prepend(flags, GINT_TO_POINTER(PURPLE_CBFLAGS_AWAY));
+        g_list_free(users);
     }
 
-    purple_conv_chat_add_users(chat, users, NULL, flags, FALSE);
+    if (wanted.empty())
+        return;
 
-    g_list_free(users);
-    g_list_free(flags);
-}
+    // Members of large chats only exist as chat users until they speak, are hovered over or an IM
+    // is opened with them, which saves creating, updating and fetching icons for thousands of
+    // buddies
+    int lazy_threshold = purple_account_get_int(acct, LINE_ACCOUNT_LAZY_MEMBERS_THRESHOLD, 200);
+    bool lazy = (lazy_threshold > 0 && (int)participants.size() > lazy_threshold);
 
-void PurpleLine::set_chat_participants(PurpleConvChat *chat, line::Room &room) {
-    purple_conv_chat_clear_users(chat);
+    gint64 start = g_get_monotonic_time();
 
     GList *users = NULL, *flags = NULL;
 
-    for (line::Contact &rc: room.contacts) {
-        // Room contacts don't have full contact information.
-        if (contacts.count(rc.mid) == 0)
-            blist_update_buddy(rc.mid, true);
-        else
-            blist_update_buddy(contacts[rc.mid], true);
+    // Users we know nothing about are looked up with one request
+    std::vector<std::string> unknown;
+
+    // Keep the order of the list, the list holds pointers into participants
+    for (auto i = participants.rbegin(); i != participants.rend(); i++) {
+        if (!wanted.count(i->first))
+            continue;
 
-        users = g_list_prepend(users, (gpointer)rc.mid.c_str());
-        flags = g_list_prepend(flags, GINT_TO_POINTER(0));
+        if (!lazy) {
+            ContactPtr contact = store.get_contact(i->first);
+            if (contact)
+                blist_update_buddy(contact, true);
+            else if (i->first != profile.mid)
+                unknown.push_back(i->first);
+        }
+
+        users = g_list_prepend(users, (gpointer)i->first.c_str());
+        flags = g_list_prepend(flags, GINT_TO_POINTER(i->second));
     }
 
-    // Room contact lists don't contain self, so add for consistency
-    users = g_list_prepend(users, (gpointer)profile.mid.c_str());
-    flags = g_list_prepend(flags, GINT_TO_POINTER(0));
+    blist_update_buddies(unknown, true);
 
-    purple_conv_chat_add_users(chat, users, NULL, flags, FALSE);
+    // Announce people joining, but not when the chat is first filled in
+    purple_conv_chat_add_users(chat, users, NULL, flags, current ? TRUE : FALSE);
 
     g_list_free(users);
     g_list_free(flags);
+
+    purple_debug_info("line", "Chat %s: %d users added%s, %d removed in %d us\n",
+        purple_conversation_get_name(purple_conv_chat_get_conversation(chat)),
+        (int)wanted.size(), lazy ? " without buddies" : "", (int)removed.size(),
+        (int)(g_get_monotonic_time() - start));
 }
 
 char *PurpleLine::get_chat_name(GHashTable *components) {
@@ -233,13 +287,15 @@ void PurpleLine::join_chat_success(ChatType type, std::string id) {
         id.c_str());
 
     if (type == ChatType::GROUP) {
-        line::Group &group = groups[id];
+        const GroupInfo *group = store.get_group(id);
 
-        set_chat_participants(PURPLE_CONV_CHAT(conv), group);
+        if (group)
+            set_chat_participants(PURPLE_CONV_CHAT(conv), *group);
     } else if (type == ChatType::ROOM) {
-        line::Room &room = rooms[id];
+        const RoomInfo *room = store.get_room(id);
 
-        set_chat_participants(PURPLE_CONV_CHAT(conv), room);
+        if (room)
+            set_chat_participants(PURPLE_CONV_CHAT(conv), *room);
     }
 }
 
@@ -292,3 +348,11 @@ int PurpleLine::chat_send(int id, const char *message, PurpleMessageFlags flags)
 PurpleChat *PurpleLine::find_blist_chat(const char *name) {
     return blist_find_chat(name, ChatType::ANY);
 }
+
+// Pidgin asks for the real name of a chat user when it is hovered over, double-clicked or has its
+// info looked up, which is when members of large chats need a buddy
+char *PurpleLine::get_cb_real_name(int, const char *who) {
+    blist_materialize_buddy(who);
+
+    return g_strdup(who);
+}
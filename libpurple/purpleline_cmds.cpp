@@ -31,6 +31,26 @@ void PurpleLine::register_commands() {
         WRAPPER(PurpleLine::cmd_open),
         "Opens an attachment (image, audio) by number.",
         nullptr);
+
+    purple_cmd_register(
+        "search",
+        "s",
+        PURPLE_CMD_P_PRPL,
+        (PurpleCmdFlag)(PURPLE_CMD_FLAG_PRPL_ONLY | PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_CHAT),
+        LINE_PRPL_ID,
+        WRAPPER(PurpleLine::cmd_search),
+        "Searches the messages of this chat stored on this computer for all of the given words.",
+        nullptr);
+
+    purple_cmd_register(
+        "linestats",
+        "",
+        PURPLE_CMD_P_PRPL,
+        (PurpleCmdFlag)(PURPLE_CMD_FLAG_PRPL_ONLY | PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_CHAT),
+        LINE_PRPL_ID,
+        WRAPPER(PurpleLine::cmd_linestats),
+        "Shows request latencies and traffic counters of this account. Times are in microseconds.",
+        nullptr);
 }
 
 PurpleCmdRet PurpleLine::cmd_sticker(PurpleConversation *conv,
@@ -172,3 +192,103 @@ PurpleCmdRet PurpleLine::cmd_open(PurpleConversation *conv,
 
     return PURPLE_CMD_RET_OK;
 }
+
+PurpleCmdRet PurpleLine::cmd_search(PurpleConversation *conv,
+    const gchar *, gchar **args, gchar **error, void *)
+{
+    std::string query(args[0] ? args[0] : "");
+
+    if (query.find_first_not_of(" \t") == std::string::npos) {
+        *error = g_strdup("Search terms required.");
+        return PURPLE_CMD_RET_FAILED;
+    }
+
+    std::string box(purple_conversation_get_name(conv));
+
+    gint64 start = g_get_monotonic_time();
+
+    std::vector<int64_t> seqs = search_index.search(box, query);
+
+    MarkupBuilder mb(1024);
+
+    mb.raw("<strong>Search results for &quot;").text(query).raw("&quot;</strong>");
+
+    int shown = 0;
+    bool more = false;
+
+    for (int64_t seq: seqs) {
+        if (shown >= SEARCH_RESULTS_MAX) {
+            more = true;
+            break;
+        }
+
+        line::Message msg;
+        if (!message_log.get(box, seq, msg))
+            continue;
+
+        // The index matches words and character pairs anywhere in the message, so check that the
+        // words actually appear as typed
+        std::string text = get_search_text(msg);
+        if (!SearchIndex::matches(text, query))
+            continue;
+
+        std::string from;
+        if (msg.from_ == profile.mid) {
+            from = profile.displayName;
+        } else {
+            ContactPtr contact = store.get_contact(msg.from_);
+            from = contact ? contact->displayName : msg.from_;
+        }
+
+        time_t mtime = (time_t)(msg.createdTime / 1000);
+
+        mb.raw("<br>(")
+            .text(purple_utf8_strftime("%Y-%m-%d %H:%M", localtime(&mtime)))
+            .raw(") <b>")
+            .text(from)
+            .raw(":</b> ")
+            .text(text);
+
+        shown++;
+    }
+
+    if (shown == 0)
+        mb.raw("<br>No messages found.");
+    else if (more)
+        mb.raw("<br>Showing the most recent matches only.");
+
+    purple_debug_info("line", "Search: %d candidates, %d shown in %d us\n",
+        (int)seqs.size(), shown, (int)(g_get_monotonic_time() - start));
+
+    purple_conversation_write(
+        conv,
+        "",
+        mb.str().c_str(),
+        (PurpleMessageFlags)PURPLE_MESSAGE_RAW,
+        time(NULL));
+
+    return PURPLE_CMD_RET_OK;
+}
+
+PurpleCmdRet PurpleLine::cmd_linestats(PurpleConversation *conv,
+    const gchar *, gchar **, gchar **, void *)
+{
+    std::stringstream report(stats_report());
+    std::string line;
+
+    MarkupBuilder mb(1024);
+
+    mb.raw("<strong>LINE stats</strong>");
+
+    while (std::getline(report, line))
+        mb.raw("<br>").text(line);
+
+    purple_conversation_write(
+        conv,
+        "",
+        mb.str().c_str(),
+        (PurpleMessageFlags)PURPLE_MESSAGE_RAW,
+        time(NULL));
+
+    return PURPLE_CMD_RET_OK;
+}
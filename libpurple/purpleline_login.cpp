@@ -7,6 +7,8 @@
 
 #include <gcrypt.h>
 
+#include "projection.hpp"
+
 static std::string hex_to_bytes(std::string hex) {
     if (hex.size() % 2 != 0)
         hex = std::string("0") + hex;
@@ -283,6 +285,15 @@ void PurpleLine::get_profile() {
         profile_contact.mid = profile.mid;
         profile_contact.displayName = profile.displayName;
 
+        previews.open(get_data_dir("previews"),
+            (size_t)purple_account_get_int(acct, LINE_ACCOUNT_PREVIEW_CACHE_SIZE, 50)
+                * 1024 * 1024);
+
+        message_log.open(get_data_dir("messages"));
+        search_index.open(get_data_dir("search"));
+
+        stats_start_snapshots();
+
         // Update display name
         purple_account_set_alias(acct, profile.displayName.c_str());
 
@@ -322,50 +333,58 @@ void PurpleLine::get_contacts() {
         std::vector<std::string> uids;
         c_out->recv_getAllContactIds(uids);
 
-        c_out->send_getContacts(uids);
-        c_out->send([this]() {
-            std::vector<line::Contact> contacts;
-            c_out->recv_getContacts(contacts);
+        auto contacts = std::make_shared<std::vector<line::Contact>>();
+
+        // The full contact list is the largest response during login, so it's decoded with the
+        // generated codec instead of through libthrift
+        std::string request;
+        CompactWriter w(request);
+        line_codec::write_getContacts(w, uids);
+
+        c_out->send_raw(
+            std::move(request),
+            [contacts](int, const std::string &body) {
+                CompactReader r((const uint8_t *)body.data(), body.size());
+                line_codec::read_getContacts(r, *contacts);
+            },
+            [this, contacts]() {
+                std::set<PurpleBuddy *> buddies_to_delete = blist_find<PurpleBuddy>();
+
+                for (line::Contact &contact: *contacts) {
+                    if (contact.status == line::ContactStatus::FRIEND)
+                        buddies_to_delete.erase(blist_update_buddy(contact));
+                }
 
-            std::set<PurpleBuddy *> buddies_to_delete = blist_find<PurpleBuddy>();
+                for (PurpleBuddy *buddy: buddies_to_delete)
+                    blist_remove_buddy(purple_buddy_get_name(buddy));
 
-            for (line::Contact &contact: contacts) {
-                if (contact.status == line::ContactStatus::FRIEND)
-                    buddies_to_delete.erase(blist_update_buddy(contact));
-            }
-
-            for (PurpleBuddy *buddy: buddies_to_delete)
-                blist_remove_buddy(purple_buddy_get_name(buddy));
+                {
+                    // Add self as buddy for those lonely debugging conversations
+                    // TODO: Remove
 
-            {
-                // Add self as buddy for those lonely debugging conversations
-                // TODO: Remove
+                    line::Contact self;
+                    self.mid = profile.mid;
+                    self.displayName = profile.displayName + " [Profile]";
+                    self.statusMessage = profile.statusMessage;
+                    self.picturePath = profile.picturePath;
 
-                line::Contact self;
-                self.mid = profile.mid;
-                self.displayName = profile.displayName + " [Profile]";
-                self.statusMessage = profile.statusMessage;
-                self.picturePath = profile.picturePath;
+                    blist_update_buddy(self);
+                }
 
-                blist_update_buddy(self);
-            }
+                purple_debug_info("line", "Buddy list sync: %d updates applied, %d skipped\n",
+                    stat_buddy_updates_applied, stat_buddy_updates_skipped);
 
-            get_groups();
-        });
+                get_groups();
+            });
     });
 }
 
 void PurpleLine::get_groups() {
-    c_out->send_getGroupIdsJoined();
-    c_out->send([this]() {
-        std::vector<std::string> gids;
-        c_out->recv_getGroupIdsJoined(gids);
-
-        c_out->send_getGroups(gids);
-        c_out->send([this]() {
-            std::vector<line::Group> groups;
-            c_out->recv_getGroups(groups);
-
+    line_codec::getGroupIdsJoined(*c_out)
+        .and_then([this](std::vector<std::string> &gids) {
+            return line_codec::getGroups(*c_out, gids);
+        })
+        .then([this](std::vector<line::Group> &groups) {
             std::set<PurpleChat *> chats_to_delete = blist_find_chats_by_type(ChatType::GROUP);
 
             for (line::Group &group: groups)
@@ -376,60 +395,99 @@ void PurpleLine::get_groups() {
 
             get_rooms();
         });
-    });
 }
 
 void PurpleLine::get_rooms() {
-    c_out->send_getMessageBoxCompactWrapUpList(1, 65535);
-    c_out->send([this]() {
-        line::MessageBoxWrapUpList wrap_up_list;
-        c_out->recv_getMessageBoxCompactWrapUpList(wrap_up_list);
+    // Rooms that aren't seen on any page are removed at the end
+    auto stale_ids = std::make_shared<std::set<std::string>>();
 
-        std::set<std::string> uids;
+    for (PurpleChat *chat: blist_find_chats_by_type(ChatType::ROOM)) {
+        char *id_ptr = (char *)g_hash_table_lookup(purple_chat_get_components(chat), "id");
+        if (id_ptr)
+            stale_ids->insert(id_ptr);
+    }
+
+    get_rooms_page(1, stale_ids);
+}
+
+// Message boxes are fetched a page at a time and each page's rooms are added as soon as it arrives,
+// so that rooms show up progressively and a heavy account's list is never in memory all at once.
+void PurpleLine::get_rooms_page(int start, std::shared_ptr<std::set<std::string>> stale_ids) {
+    c_out->send_getMessageBoxCompactWrapUpList(start, MESSAGE_BOX_PAGE_SIZE);
+    c_out->send([this, start, stale_ids]() {
+        auto rooms = std::make_shared<std::vector<line::Room>>();
+        int count;
+
+        {
+            line::MessageBoxWrapUpList wrap_up_list;
+            c_out->recv_getMessageBoxCompactWrapUpList(wrap_up_list);
+
+            count = (int)wrap_up_list.messageBoxWrapUpList.size();
 
-        for (line::MessageBoxWrapUp &ent: wrap_up_list.messageBoxWrapUpList) {
-            if (ent.messageBox.midType != line::MIDType::ROOM)
-                continue;
+            for (line::MessageBoxWrapUp &ent: wrap_up_list.messageBoxWrapUpList) {
+                if (ent.messageBox.midType != line::MIDType::ROOM)
+                    continue;
 
-            for (line::Contact &c: ent.contacts)
-                uids.insert(c.mid);
+                rooms->emplace_back();
+                rooms->back().mid = ent.messageBox.id;
+                rooms->back().contacts.swap(ent.contacts);
+            }
         }
 
+        std::set<std::string> uids;
+
+        for (line::Room &room: *rooms) {
+            for (line::Contact &c: room.contacts) {
+                if (!store.get_contact(c.mid))
+                    uids.insert(c.mid);
+            }
+        }
+
+        auto next = [this, start, count, rooms, stale_ids]() {
+            update_rooms(*rooms, *stale_ids);
+
+            // The server may return short pages before the end, so only an empty page means the
+            // whole list has been seen and unseen rooms are really gone
+            if (count == 0)
+                remove_stale_rooms(*stale_ids);
+            else
+                get_rooms_page(start + count, stale_ids);
+        };
+
         if (!uids.empty()) {
-            // Room contacts don't contain full contact information, so pull separately to get names
+            // Room contacts don't contain full contact information, so pull the ones we don't know
+            // yet separately to get names
 
             c_out->send_getContacts(std::vector<std::string>(uids.begin(), uids.end()));
-            c_out->send([this, wrap_up_list]{
+            c_out->send([this, next]{
                 std::vector<line::Contact> contacts;
                 c_out->recv_getContacts(contacts);
 
                 for (line::Contact &c: contacts)
-                    this->contacts[c.mid] = c;
+                    store.update_contact(c);
 
-                update_rooms(wrap_up_list);
+                next();
             });
         } else {
-            update_rooms(wrap_up_list);
+            next();
         }
     });
 }
 
-void PurpleLine::update_rooms(line::MessageBoxWrapUpList wrap_up_list) {
-    std::set<PurpleChat *> chats_to_delete = blist_find_chats_by_type(ChatType::ROOM);
+void PurpleLine::update_rooms(std::vector<line::Room> &rooms, std::set<std::string> &stale_ids) {
+    for (line::Room &room: rooms) {
+        blist_update_chat(room);
 
-    for (line::MessageBoxWrapUp &ent: wrap_up_list.messageBoxWrapUpList) {
-        if (ent.messageBox.midType != line::MIDType::ROOM)
-            continue;
-
-        line::Room room;
-        room.mid = ent.messageBox.id;
-        room.contacts = ent.contacts;
-
-        chats_to_delete.erase(blist_update_chat(room));
+        stale_ids.erase(room.mid);
     }
+}
 
-    for (PurpleChat *chat: chats_to_delete)
-        purple_blist_remove_chat(chat);
+void PurpleLine::remove_stale_rooms(std::set<std::string> &stale_ids) {
+    for (const std::string &id: stale_ids) {
+        PurpleChat *chat = blist_find_chat(id, ChatType::ROOM);
+        if (chat)
+            purple_blist_remove_chat(chat);
+    }
 
     get_group_invites();
 }
@@ -445,20 +503,34 @@ void PurpleLine::get_group_invites() {
             return;
         }
 
+        auto groups = std::make_shared<std::vector<line::Group>>();
+
         c_out->send_getGroups(gids);
-        c_out->send([this]() {
-            std::vector<line::Group> groups;
-            c_out->recv_getGroups(groups);
+        c_out->send_raw(
+            [groups](int, const std::string &body) {
+                // Invites only show the group name, so skip the member lists
+                static const FieldSet group_fields = field_set({ 1, 10 });
 
-            for (line::Group &g: groups)
-                handle_group_invite(g, profile_contact, no_contact);
+                CompactReader r((const uint8_t *)body.data(), body.size());
 
-            login_done();
-        });
+                read_reply(r, "getGroups", [&](CompactReader &r, int type) {
+                    read_list(r, type, *groups, [&](line::Group &g) {
+                        read_group(r, g, group_fields, 0);
+                    });
+                });
+            },
+            [this, groups]() {
+                for (line::Group &g: *groups)
+                    handle_group_invite(g, profile_contact, no_contact);
+
+                login_done();
+            });
     });
 }
 
 void PurpleLine::login_done() {
+    purple_debug_info("line", "Contact store: %d bytes\n", (int)store.memory_usage());
+
     poller.start();
 
     purple_connection_update_progress(conn, "Connected", 2, 3);
@@ -6,17 +6,19 @@ static std::string get_sticker_id(line::Message &msg) {
     if (meta.count("STKID") == 0 || meta.count("STKVER") == 0 || meta.count("STKPKGID") == 0)
         return "";
 
-    std::stringstream id;
+    // The ID is used both as the smiley shortcut and in the message markup, so escape the parts
+    // that come from the server
+    MarkupBuilder id(64);
 
-    id << "[LINE sticker "
-        << meta["STKVER"] << "/"
-        << meta["STKPKGID"] << "/"
-        << meta["STKID"];
+    id.raw("[LINE sticker ")
+        .text(meta["STKVER"]).raw("/")
+        .text(meta["STKPKGID"]).raw("/")
+        .text(meta["STKID"]);
 
     if (meta.count("STKTXT") == 1)
-        id << " " << meta["STKTXT"];
+        id.raw(" ").text(meta["STKTXT"]);
 
-    id << "]";
+    id.raw("]");
 
     return id.str();
 }
@@ -44,6 +46,16 @@ static std::string get_sticker_url(line::Message &msg, bool thumb = false) {
     return url.str();
 }
 
+// Keeps a live message for opening conversations, serving history and searching. Messages must be
+// stored in the order they arrived, as the message log links each one to the previous one.
+void PurpleLine::store_live_message(const line::Message &msg) {
+    std::string box = MessageRing::box_id(msg, profile.mid);
+
+    warm_messages.push(box, msg);
+    message_log.append_live(box, msg);
+    index_message(box, msg);
+}
+
 void PurpleLine::write_message(line::Message &msg, bool replay) {
     std::string text;
     int flags = 0;
@@ -51,16 +63,14 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
 
     bool sent = (msg.from_ == profile.mid);
 
-    if (std::find(recent_messages.cbegin(), recent_messages.cend(), msg.id)
-        != recent_messages.cend())
-    {
+    if (recent_messages.contains(msg.id)) {
         // We already processed this message. User is probably talking with himself.
         return;
     }
 
     // Hack
     if (msg.from_ == msg.to)
-        push_recent_message(msg.id);
+        recent_messages.insert(msg.id);
 
     PurpleConversation *conv = purple_find_conversation_with_account(
         (msg.toType == line::MIDType::USER ? PURPLE_CONV_TYPE_IM : PURPLE_CONV_TYPE_CHAT),
@@ -83,6 +93,14 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
         }
     }
 
+    // Queued messages come through here again when they are played back
+    if (!replay)
+        store_live_message(msg);
+
+    // Members of large chats get a buddy once they say something
+    if (conv && !sent && purple_conversation_get_type(conv) == PURPLE_CONV_TYPE_CHAT)
+        blist_materialize_buddy(msg.from_);
+
     // Replaying messages from history
     // Unfortunately Pidgin displays messages with this flag with odd formatting and no username.
     // Disable for now.
@@ -95,17 +113,24 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
             if (msg.__isset.location) {
                 line::Location &loc = msg.location;
 
-                text = markup_escape(loc.title)
-                    + " | <a href=\"https://maps.google.com/?q=" + url_encode(loc.address)
-                    + "&ll=" + std::to_string(loc.latitude)
-                    + "," + std::to_string(loc.longitude)
-                    + "\">"
-                    + (loc.address.size()
-                        ? markup_escape(loc.address)
-                        : "(no address)")
-                    + "</a>";
+                MarkupBuilder mb;
+
+                mb.text(loc.title)
+                    .raw(" | <a href=\"https://maps.google.com/?q=").raw(url_encode(loc.address))
+                    .raw("&ll=").raw(std::to_string(loc.latitude))
+                    .raw(",").raw(std::to_string(loc.longitude))
+                    .raw("\">");
+
+                if (loc.address.size())
+                    mb.text(loc.address);
+                else
+                    mb.raw("(no address)");
+
+                mb.raw("</a>");
+
+                text = std::move(mb.str());
             } else {
-                text = markup_escape(msg.text);
+                markup_escape_append(text, msg.text.data(), msg.text.size());
             }
             break;
 
@@ -153,20 +178,26 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
 
                 std::string id = "[LINE " + type_std + " " + msg.id + "]";
 
-                text = id;
+                MarkupBuilder mb;
+
+                mb.raw(id);
 
                 if (conv) {
-                    text += " <font color=\"#888888\">/open "
-                        + conv_attachment_add(conv, msg.contentType, msg.id)
-                        + "</font>";
+                    mb.raw(" <font color=\"#888888\">/open ")
+                        .raw(conv_attachment_add(conv, msg.contentType, msg.id))
+                        .raw("</font>");
                 }
 
+                text = std::move(mb.str());
+
                 if (!conv
                     || !purple_conv_custom_smiley_add(conv, id.c_str(), "id", id.c_str(), TRUE))
                 {
                     break;
                 }
 
+                std::string preview;
+
                 if (msg.contentPreview.size() > 0) {
                     purple_conv_custom_smiley_write(
                         conv,
@@ -174,16 +205,27 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
                         (const guchar *)msg.contentPreview.c_str(),
                         msg.contentPreview.size());
 
+                    purple_conv_custom_smiley_close(conv, id.c_str());
+                } else if (previews.get(msg.id, preview)) {
+                    purple_conv_custom_smiley_write(
+                        conv,
+                        id.c_str(),
+                        (const guchar *)preview.c_str(),
+                        preview.size());
+
                     purple_conv_custom_smiley_close(conv, id.c_str());
                 } else {
                     std::string preview_url = msg.contentMetadata.count("PREVIEW_URL")
                         ? msg.contentMetadata["PREVIEW_URL"]
                         : std::string(LINE_OS_URL) + "os/m/" + msg.id + "/preview";
+                    std::string msg_id = msg.id;
 
                     http.request(preview_url, HTTPFlag::AUTH | HTTPFlag::LARGE,
-                        [this, id, conv](int status, const guchar *data, gsize len)
+                        [this, id, conv, msg_id](int status, const guchar *data, gsize len)
                         {
                             if (status == 200 && data && len > 0) {
+                                previews.put(msg_id, data, len);
+
                                 purple_conv_custom_smiley_write(
                                     conv,
                                     id.c_str(),
@@ -204,7 +246,9 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
 
         case line::ContentType::AUDIO:
             {
-                text = "[Audio message";
+                MarkupBuilder mb;
+
+                mb.raw("[Audio message");
 
                 if (msg.contentMetadata.count("AUDLEN")) {
                     int len = 0;
@@ -214,21 +258,23 @@ void PurpleLine::write_message(line::Message &msg, bool replay) {
                     } catch(...) { /* ignore */ }
 
                     if (len > 0) {
-                        text += " "
-                            + std::to_string(len / 1000)
-                            + "."
-                            + std::to_string((len % 1000) / 100)
-                            + "s";
+                        mb.raw(" ")
+                            .number(len / 1000)
+                            .raw(".")
+                            .number((len % 1000) / 100)
+                            .raw("s");
                     }
                 }
 
-                text += "]";
+                mb.raw("]");
 
                 if (conv) {
-                    text += " <font color=\"#888888\">/open "
-                        + conv_attachment_add(conv, msg.contentType, msg.id)
-                        + "</font>";
+                    mb.raw(" <font color=\"#888888\">/open ")
+                        .raw(conv_attachment_add(conv, msg.contentType, msg.id))
+                        .raw("</font>");
                 }
+
+                text = std::move(mb.str());
             }
             break;
 
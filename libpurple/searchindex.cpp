@@ -0,0 +1,471 @@
+#include <algorithm>
+
+#include <glib/gstdio.h>
+
+#include <debug.h>
+
+#include "searchindex.hpp"
+
+static const char snapshot_magic[] = "LSI1";
+
+static bool is_cjk(gunichar c) {
+    return (c >= 0x3040 && c <= 0x30ff) // Hiragana and Katakana
+        || (c >= 0x3400 && c <= 0x4dbf) // CJK Extension A
+        || (c >= 0x4e00 && c <= 0x9fff) // CJK Unified Ideographs
+        || (c >= 0xac00 && c <= 0xd7af) // Hangul syllables
+        || (c >= 0xf900 && c <= 0xfaff) // CJK Compatibility Ideographs
+        || (c >= 0xff66 && c <= 0xff9f); // Half-width Katakana
+}
+
+static void put_varint(std::string &buf, uint64_t v) {
+    while (v >= 0x80) {
+        buf.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+
+    buf.push_back((char)v);
+}
+
+static void put_string(std::string &buf, const std::string &s) {
+    put_varint(buf, s.size());
+    buf.append(s);
+}
+
+// Reads from a buffer and remembers if it ran out
+struct Reader {
+    const unsigned char *p, *end;
+    bool ok;
+
+    Reader(const std::string &buf)
+        : p((const unsigned char *)buf.data()), end(p + buf.size()), ok(true) { }
+
+    uint64_t varint() {
+        uint64_t v = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p >= end) {
+                ok = false;
+                return 0;
+            }
+
+            unsigned char b = *p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+
+            if (!(b & 0x80))
+                return v;
+        }
+
+        ok = false;
+        return 0;
+    }
+
+    std::string string() {
+        uint64_t len = varint();
+
+        if (!ok || (uint64_t)(end - p) < len) {
+            ok = false;
+            return "";
+        }
+
+        std::string s((const char *)p, (size_t)len);
+        p += len;
+
+        return s;
+    }
+};
+
+static bool read_file(const std::string &path, std::string &data) {
+    gchar *contents;
+    gsize len;
+
+    if (!g_file_get_contents(path.c_str(), &contents, &len, nullptr))
+        return false;
+
+    data.assign(contents, len);
+    g_free(contents);
+
+    return true;
+}
+
+SearchIndex::SearchIndex() :
+    journal_size(0)
+{
+}
+
+void SearchIndex::open(std::string dir) {
+    this->dir = dir;
+
+    boxes.clear();
+    box_index.clear();
+    docs.clear();
+    indexed.clear();
+    postings.clear();
+    journal_size = 0;
+
+    gint64 start = g_get_monotonic_time();
+
+    load_snapshot();
+    load_journal();
+
+    purple_debug_info("line", "Search index: %d messages, %d terms, loaded in %d ms\n",
+        (int)docs.size(), (int)postings.size(), (int)((g_get_monotonic_time() - start) / 1000));
+
+    if (journal_size >= COMPACT_THRESHOLD)
+        compact();
+}
+
+void SearchIndex::tokenize(const std::string &text, std::vector<std::string> &terms,
+    bool query)
+{
+    const gchar *p = text.data(), *end = p + text.size();
+
+    std::string word;
+    gunichar prev_cjk = 0;
+    bool cjk_run_single = false;
+
+    char buf[8];
+
+    auto flush_word = [&]() {
+        if (word.size()) {
+            terms.push_back(word);
+            word.clear();
+        }
+    };
+
+    auto end_cjk_run = [&]() {
+        // A lone CJK character in a query can't form a pair, so look it up on its own
+        if (cjk_run_single)
+            terms.push_back(std::string(buf, g_unichar_to_utf8(prev_cjk, buf)));
+
+        prev_cjk = 0;
+        cjk_run_single = false;
+    };
+
+    while (p < end) {
+        gunichar c = g_utf8_get_char_validated(p, end - p);
+
+        if (c == (gunichar)-1 || c == (gunichar)-2) {
+            // Invalid UTF-8 separates terms
+            flush_word();
+            end_cjk_run();
+
+            p++;
+            continue;
+        }
+
+        char cbuf[8];
+        int clen = g_unichar_to_utf8(c, cbuf);
+        p += clen;
+
+        if (is_cjk(c)) {
+            flush_word();
+
+            // Indexed text gets every character as well as every pair, so that single character
+            // queries find characters inside longer runs
+            if (!query)
+                terms.push_back(std::string(cbuf, clen));
+
+            if (prev_cjk) {
+                std::string pair(buf, g_unichar_to_utf8(prev_cjk, buf));
+                pair.append(cbuf, clen);
+                terms.push_back(pair);
+
+                cjk_run_single = false;
+            } else {
+                cjk_run_single = query;
+            }
+
+            prev_cjk = c;
+        } else if (g_unichar_isalnum(c)) {
+            end_cjk_run();
+
+            word.append(buf, g_unichar_to_utf8(g_unichar_tolower(c), buf));
+        } else {
+            flush_word();
+            end_cjk_run();
+        }
+    }
+
+    flush_word();
+    end_cjk_run();
+
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+}
+
+uint32_t SearchIndex::intern_box(const std::string &box) {
+    auto i = box_index.find(box);
+    if (i != box_index.end())
+        return i->second;
+
+    uint32_t id = (uint32_t)boxes.size();
+
+    boxes.push_back(box);
+    box_index[box] = id;
+    indexed.emplace_back();
+
+    return id;
+}
+
+bool SearchIndex::insert(uint32_t box, int64_t seq, std::vector<std::string> &terms) {
+    if (!indexed[box].insert(seq).second)
+        return false;
+
+    uint32_t doc = (uint32_t)docs.size();
+    docs.push_back(Doc { box, seq });
+
+    for (std::string &term: terms)
+        postings[term].push_back(doc);
+
+    return true;
+}
+
+void SearchIndex::add(const std::string &box, int64_t seq, const std::string &text) {
+    if (dir.empty() || seq < 0 || text.empty())
+        return;
+
+    uint32_t box_id = intern_box(box);
+
+    if (indexed[box_id].count(seq))
+        return;
+
+    std::vector<std::string> terms;
+    tokenize(text, terms, false);
+
+    if (terms.empty())
+        return;
+
+    insert(box_id, seq, terms);
+    append_journal(box, seq, terms);
+
+    if (journal_size >= COMPACT_THRESHOLD)
+        compact();
+}
+
+std::vector<int64_t> SearchIndex::search(const std::string &box, const std::string &query) const {
+    std::vector<int64_t> result;
+
+    auto b = box_index.find(box);
+    if (b == box_index.end())
+        return result;
+
+    std::vector<std::string> terms;
+    tokenize(query, terms, true);
+
+    if (terms.empty())
+        return result;
+
+    std::vector<const std::vector<uint32_t> *> lists;
+
+    for (std::string &term: terms) {
+        auto i = postings.find(term);
+        if (i == postings.end())
+            return result;
+
+        lists.push_back(&i->second);
+    }
+
+    // Walk the shortest list and look the documents up in the others
+    std::sort(lists.begin(), lists.end(),
+        [](const std::vector<uint32_t> *a, const std::vector<uint32_t> *b) {
+            return a->size() < b->size();
+        });
+
+    for (uint32_t doc: *lists[0]) {
+        if (docs[doc].box != b->second)
+            continue;
+
+        bool all = true;
+
+        for (size_t i = 1; i < lists.size() && all; i++)
+            all = std::binary_search(lists[i]->begin(), lists[i]->end(), doc);
+
+        if (all)
+            result.push_back(docs[doc].seq);
+    }
+
+    std::sort(result.begin(), result.end(), std::greater<int64_t>());
+
+    return result;
+}
+
+bool SearchIndex::matches(const std::string &text, const std::string &query) {
+    gchar *folded_text = g_utf8_casefold(text.c_str(), text.size());
+    gchar *folded_query = g_utf8_casefold(query.c_str(), query.size());
+
+    std::string haystack(folded_text);
+
+    bool all = true;
+
+    gchar **words = g_strsplit_set(folded_query, " \t\n", -1);
+
+    for (gchar **w = words; *w && all; w++) {
+        if (**w && haystack.find(*w) == std::string::npos)
+            all = false;
+    }
+
+    g_strfreev(words);
+    g_free(folded_query);
+    g_free(folded_text);
+
+    return all;
+}
+
+void SearchIndex::load_snapshot() {
+    std::string data;
+    if (!read_file(dir + G_DIR_SEPARATOR_S "search.idx", data))
+        return;
+
+    if (data.compare(0, 4, snapshot_magic) != 0) {
+        purple_debug_warning("line", "Search index snapshot has an unknown format\n");
+        return;
+    }
+
+    Reader r(data);
+    r.p += 4;
+
+    uint64_t n_boxes = r.varint();
+    for (uint64_t i = 0; i < n_boxes && r.ok; i++)
+        intern_box(r.string());
+
+    uint64_t n_docs = r.varint();
+    for (uint64_t i = 0; i < n_docs && r.ok; i++) {
+        uint32_t box = (uint32_t)r.varint();
+        int64_t seq = (int64_t)r.varint();
+
+        if (box >= boxes.size())
+            r.ok = false;
+
+        if (r.ok) {
+            docs.push_back(Doc { box, seq });
+            indexed[box].insert(seq);
+        }
+    }
+
+    uint64_t n_terms = r.varint();
+    for (uint64_t i = 0; i < n_terms && r.ok; i++) {
+        std::string term = r.string();
+        uint64_t n = r.varint();
+
+        std::vector<uint32_t> &list = postings[term];
+        list.reserve((size_t)std::min<uint64_t>(n, docs.size()));
+
+        uint32_t doc = 0;
+        for (uint64_t j = 0; j < n && r.ok; j++) {
+            doc += (uint32_t)r.varint();
+
+            if (doc >= docs.size())
+                r.ok = false;
+            else
+                list.push_back(doc);
+        }
+    }
+
+    if (!r.ok) {
+        purple_debug_warning("line", "Search index snapshot is corrupt, starting over\n");
+
+        boxes.clear();
+        box_index.clear();
+        docs.clear();
+        indexed.clear();
+        postings.clear();
+    }
+}
+
+void SearchIndex::load_journal() {
+    std::string data;
+    if (!read_file(dir + G_DIR_SEPARATOR_S "search.journal", data))
+        return;
+
+    Reader r(data);
+
+    while (r.p < r.end) {
+        std::string box = r.string();
+        int64_t seq = (int64_t)r.varint();
+
+        // Every term takes at least a byte, so a larger count can only come from a damaged record
+        uint64_t n_terms = r.varint();
+        if (n_terms > (uint64_t)(r.end - r.p))
+            r.ok = false;
+
+        std::vector<std::string> terms;
+        if (r.ok)
+            terms.resize((size_t)n_terms);
+
+        for (std::string &term: terms)
+            term = r.string();
+
+        // A record that was cut short is the last one
+        if (!r.ok)
+            break;
+
+        insert(intern_box(box), seq, terms);
+        journal_size++;
+    }
+}
+
+void SearchIndex::append_journal(const std::string &box, int64_t seq,
+    std::vector<std::string> &terms)
+{
+    std::string record;
+
+    put_string(record, box);
+    put_varint(record, (uint64_t)seq);
+    put_varint(record, terms.size());
+
+    for (std::string &term: terms)
+        put_string(record, term);
+
+    std::string path = dir + G_DIR_SEPARATOR_S "search.journal";
+
+    FILE *f = g_fopen(path.c_str(), "ab");
+    if (!f)
+        return;
+
+    bool ok = (fwrite(record.data(), 1, record.size(), f) == record.size());
+
+    if (fclose(f) != 0 || !ok)
+        purple_debug_warning("line", "Couldn't write search journal\n");
+
+    journal_size++;
+}
+
+void SearchIndex::compact() {
+    std::string data(snapshot_magic, 4);
+
+    put_varint(data, boxes.size());
+    for (std::string &box: boxes)
+        put_string(data, box);
+
+    put_varint(data, docs.size());
+    for (Doc &doc: docs) {
+        put_varint(data, doc.box);
+        put_varint(data, (uint64_t)doc.seq);
+    }
+
+    put_varint(data, postings.size());
+    for (auto &p: postings) {
+        put_string(data, p.first);
+        put_varint(data, p.second.size());
+
+        uint32_t prev = 0;
+        for (uint32_t doc: p.second) {
+            put_varint(data, doc - prev);
+            prev = doc;
+        }
+    }
+
+    std::string path = dir + G_DIR_SEPARATOR_S "search.idx";
+
+    // Written to a temporary file and renamed over the old one, so the journal is only removed
+    // once its contents are safely in the snapshot
+    if (!g_file_set_contents(path.c_str(), data.data(), data.size(), nullptr)) {
+        purple_debug_warning("line", "Couldn't write search index snapshot\n");
+        return;
+    }
+
+    g_unlink((dir + G_DIR_SEPARATOR_S "search.journal").c_str());
+    journal_size = 0;
+
+    purple_debug_info("line", "Search index snapshot: %d bytes\n", (int)data.size());
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+// Inverted index over the text of stored messages, for searching history without the server.
+// Messages are identified by their message box and seq, and their text is read back from the
+// message log. Text is split into lowercased words, and CJK text, which has no spaces, into
+// single characters and overlapping pairs of characters. A message matches if it contains every
+// term of the query, so results should be checked against the actual text with matches().
+//
+// The index is saved as a snapshot with delta-encoded postings, and messages added since the
+// snapshot are appended to a journal. The journal is merged into a new snapshot once it gets long.
+class SearchIndex {
+
+    static const size_t COMPACT_THRESHOLD = 10000;
+
+    struct Doc {
+        uint32_t box;
+        int64_t seq;
+    };
+
+    std::string dir;
+
+    std::vector<std::string> boxes;
+    std::unordered_map<std::string, uint32_t> box_index;
+
+    std::vector<Doc> docs;
+    // Seqs indexed so far, by box
+    std::vector<std::unordered_set<int64_t>> indexed;
+
+    // Document IDs containing each term, in ascending order
+    std::unordered_map<std::string, std::vector<uint32_t>> postings;
+
+    size_t journal_size;
+
+public:
+
+    SearchIndex();
+
+    void open(std::string dir);
+
+    void add(const std::string &box, int64_t seq, const std::string &text);
+
+    // Seqs of messages in a box that contain every term of the query, newest first
+    std::vector<int64_t> search(const std::string &box, const std::string &query) const;
+
+    // Whether text contains every word of the query, ignoring case
+    static bool matches(const std::string &text, const std::string &query);
+
+    size_t size() const { return docs.size(); }
+
+private:
+
+    // Queries only need pairs of CJK characters, or the character itself if it stands alone
+    static void tokenize(const std::string &text, std::vector<std::string> &terms, bool query);
+
+    uint32_t intern_box(const std::string &box);
+    bool insert(uint32_t box, int64_t seq, std::vector<std::string> &terms);
+
+    void load_snapshot();
+    void load_journal();
+    void append_journal(const std::string &box, int64_t seq, std::vector<std::string> &terms);
+    void compact();
+
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+
+// Lock-free queue of pointers between exactly one producer thread and one consumer thread. Holds
+// at most N - 1 items.
+template <typename T, size_t N>
+class SpscQueue {
+
+    T *slots[N];
+
+    // head is only written by the consumer and tail only by the producer
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+
+public:
+
+    SpscQueue() : head(0), tail(0) { }
+
+    // Returns false if the queue is full
+    bool push(T *item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % N;
+
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+
+        slots[t] = item;
+        tail.store(next, std::memory_order_release);
+
+        return true;
+    }
+
+    // Returns nullptr if the queue is empty
+    T *pop() {
+        size_t h = head.load(std::memory_order_relaxed);
+
+        if (h == tail.load(std::memory_order_acquire))
+            return nullptr;
+
+        T *item = slots[h];
+        head.store((h + 1) % N, std::memory_order_release);
+
+        return item;
+    }
+
+};
@@ -0,0 +1,74 @@
+#include <string.h>
+
+#include <sstream>
+
+#include "stats.hpp"
+
+Histogram::Histogram() :
+    count_(0),
+    sum_(0),
+    max_(0)
+{
+    memset(buckets, 0, sizeof(buckets));
+}
+
+void Histogram::add(uint64_t value) {
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && (value >> bucket) != 0)
+        bucket++;
+
+    buckets[bucket]++;
+
+    count_++;
+    sum_ += value;
+
+    if (value > max_)
+        max_ = value;
+}
+
+uint64_t Histogram::percentile(int percent) const {
+    uint64_t target = (count_ * percent + 99) / 100, seen = 0;
+
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += buckets[i];
+
+        if (seen >= target && seen > 0) {
+            uint64_t bound = (i == 0) ? 0 : ((uint64_t)1 << i) - 1;
+
+            return (bound < max_) ? bound : max_;
+        }
+    }
+
+    return max_;
+}
+
+void Stats::add(const std::string &name, uint64_t value) {
+    histograms[name].add(value);
+}
+
+void Stats::count(const std::string &name, uint64_t n) {
+    counters[name] += n;
+}
+
+std::string Stats::report() const {
+    std::stringstream ss;
+
+    for (auto &p: counters)
+        ss << p.first << ": " << p.second << "\n";
+
+    for (auto &p: histograms) {
+        const Histogram &h = p.second;
+
+        ss
+            << p.first << ":"
+            << " n=" << h.count()
+            << " avg=" << (h.count() ? h.sum() / h.count() : 0)
+            << " p50=" << h.percentile(50)
+            << " p90=" << h.percentile(90)
+            << " p99=" << h.percentile(99)
+            << " max=" << h.max()
+            << "\n";
+    }
+
+    return ss.str();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+// Distribution of values with power of two buckets. Cheap enough to update on every request, at
+// the cost of percentiles only being known to within a factor of two.
+class Histogram {
+
+    static const int BUCKETS = 40;
+
+    // Bucket 0 counts zeroes and bucket i values in [2^(i-1), 2^i). The last one takes the rest.
+    uint64_t buckets[BUCKETS];
+
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+
+public:
+
+    Histogram();
+
+    void add(uint64_t value);
+
+    uint64_t count() const { return count_; }
+    uint64_t sum() const { return sum_; }
+    uint64_t max() const { return max_; }
+
+    // Upper bound for the value below which percent percent of the values fall
+    uint64_t percentile(int percent) const;
+
+};
+
+// Performance counters and histograms of one account, keyed by name. Latencies are recorded in
+// microseconds, and names say what they measure, e.g. "rpc_us sendMessage".
+class Stats {
+
+    std::map<std::string, Histogram> histograms;
+    std::map<std::string, uint64_t> counters;
+
+public:
+
+    void add(const std::string &name, uint64_t value);
+    void count(const std::string &name, uint64_t n=1);
+
+    // Counters and then histograms, one per line and sorted by name
+    std::string report() const;
+
+};
@@ -2,6 +2,7 @@
 #include <connection.h>
 
 #include <thrift/protocol/TCompactProtocol.h>
+#include <thrift/transport/TBufferTransports.h>
 
 #include "constants.hpp"
 #include "thriftclient.hpp"
@@ -13,6 +14,8 @@ ThriftClient::ThriftClient(PurpleAccount *acct, PurpleConnection *conn, std::str
     path(path)
 {
     http = boost::static_pointer_cast<LineHttpTransport>(getInputProtocol()->getTransport());
+
+    background_decode = purple_account_get_bool(acct, LINE_ACCOUNT_BACKGROUND_DECODE, FALSE);
 }
 
 void ThriftClient::set_path(std::string path) {
@@ -23,10 +26,74 @@ void ThriftClient::set_auto_reconnect(bool auto_reconnect) {
     http->set_auto_reconnect(auto_reconnect);
 }
 
+void ThriftClient::set_stats(Stats *stats) {
+    http->set_stats(stats);
+}
+
 void ThriftClient::send(std::function<void()> callback) {
     http->request("POST", path, "application/x-thrift", callback);
 }
 
+void ThriftClient::send(std::function<void(int status, line::TalkServiceClient &client)> decode,
+    std::function<void()> callback)
+{
+    if (!background_decode) {
+        http->request("POST", path, "application/x-thrift", [this, decode, callback]() {
+            decode(http->status_code(), *this);
+            callback();
+        });
+
+        return;
+    }
+
+    http->request("POST", path, "application/x-thrift", callback,
+        [decode](int status, std::string &body) {
+            boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> buf =
+                boost::make_shared<apache::thrift::transport::TMemoryBuffer>(
+                    (uint8_t *)&body[0], (uint32_t)body.size());
+
+            line::TalkServiceClient client(
+                boost::make_shared<apache::thrift::protocol::TCompactProtocol>(buf));
+
+            decode(status, client);
+        });
+}
+
+void ThriftClient::send_raw(std::function<void(int status, const std::string &body)> decode,
+    std::function<void()> callback)
+{
+    if (!background_decode) {
+        http->request("POST", path, "application/x-thrift", [this, decode, callback]() {
+            decode(http->status_code(), http->response());
+            callback();
+        });
+
+        return;
+    }
+
+    http->request("POST", path, "application/x-thrift", callback, decode);
+}
+
+void ThriftClient::send_raw(std::string request,
+    std::function<void(int status, const std::string &body)> decode,
+    std::function<void()> callback)
+{
+    std::vector<LineHttpTransport::BodyPart> body;
+    body.emplace_back(std::move(request));
+
+    if (!background_decode) {
+        http->request("POST", path, "application/x-thrift", std::move(body),
+            [this, decode, callback]() {
+                decode(http->status_code(), http->response());
+                callback();
+            });
+
+        return;
+    }
+
+    http->request("POST", path, "application/x-thrift", std::move(body), callback, decode);
+}
+
 int ThriftClient::status_code() {
     return http->status_code();
 }
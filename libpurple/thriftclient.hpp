@@ -12,6 +12,8 @@
 
 #include "thrift_line/TalkService.h"
 
+#include "compactreader.hpp"
+#include "future.hpp"
 #include "linehttptransport.hpp"
 
 class ThriftClient : public line::TalkServiceClient {
@@ -19,14 +21,56 @@ class ThriftClient : public line::TalkServiceClient {
     std::string path;
     boost::shared_ptr<LineHttpTransport> http;
 
+    bool background_decode;
+
 public:
 
     ThriftClient(PurpleAccount *acct, PurpleConnection *conn, std::string path);
 
     void set_path(std::string path);
     void set_auto_reconnect(bool auto_reconnect);
+    void set_stats(Stats *stats);
     void send(std::function<void()> callback);
 
+    // Like above, but the response is read by decode, which may be run on a worker thread with a
+    // client of its own. decode must only call recv_* and must not touch libpurple, so it gets the
+    // status code of the response passed in. callback is run on the main loop afterwards. Used for
+    // responses that can be large.
+    void send(std::function<void(int status, line::TalkServiceClient &client)> decode,
+        std::function<void()> callback);
+
+    // Like above, but decode reads the raw response body, usually with CompactReader. The body is
+    // kept alive until callback has run, so views into it can be used there.
+    void send_raw(std::function<void(int status, const std::string &body)> decode,
+        std::function<void()> callback);
+
+    // Sends a request encoded with the generated codec (see codec.hpp) instead of one written by
+    // the send_* functions. Used together with the codec's read_* functions in decode.
+    void send_raw(std::string request,
+        std::function<void(int status, const std::string &body)> decode,
+        std::function<void()> callback);
+
+    // Sends a request encoded with the codec and returns a future for the result read by read.
+    // Calls have their own request and response buffers, so any number of them can be queued at
+    // once. The typed wrappers generated into line_codec.hpp are built on this.
+    template <typename T>
+    Future<T> call(std::string request, std::function<void(CompactReader &r, T &result)> read) {
+        Promise<T> promise;
+        auto result = std::make_shared<T>();
+
+        send_raw(
+            std::move(request),
+            [read, result](int, const std::string &body) {
+                CompactReader r((const uint8_t *)body.data(), body.size());
+                read(r, *result);
+            },
+            [promise, result]() {
+                promise.set_value(std::move(*result));
+            });
+
+        return promise.future();
+    }
+
     int status_code();
     void close();
 
@@ -0,0 +1,250 @@
+#include <sstream>
+#include <iomanip>
+
+#include <time.h>
+
+#include <conversation.h>
+#include <debug.h>
+#include <eventloop.h>
+#include <util.h>
+
+#include "constants.hpp"
+#include "uploadscheduler.hpp"
+#include "wrapper.hpp"
+
+UploadScheduler::UploadScheduler(PurpleAccount *acct, PurpleConnection *conn) :
+    acct(acct),
+    conn(conn),
+    tick_timeout(0),
+    next_number(1),
+    stat_completed(0),
+    stat_failed(0),
+    stat_retries(0),
+    stat_bytes(0),
+    stat_transfer_time(0),
+    stat_latency(0)
+{
+}
+
+UploadScheduler::~UploadScheduler() {
+    if (tick_timeout)
+        purple_timeout_remove(tick_timeout);
+
+    for (Connection &c: connections)
+        delete c.upload;
+
+    for (Upload *u: queue)
+        delete u;
+
+    for (Upload *u: retry_queue)
+        delete u;
+}
+
+void UploadScheduler::upload(std::string conv_name, std::string description,
+    std::string path, std::string content_type,
+    std::vector<LineHttpTransport::BodyPart> body)
+{
+    Upload *u = new Upload();
+    u->number = next_number++;
+    u->conv_name = conv_name;
+    u->description = description;
+    u->path = path;
+    u->content_type = content_type;
+    u->body = std::move(body);
+    u->size = 0;
+    u->attempts = 0;
+    u->reported_percent = 0;
+    u->queue_time = g_get_monotonic_time();
+    u->start_time = 0;
+    u->retry_time = 0;
+
+    for (LineHttpTransport::BodyPart &part: u->body)
+        u->size += part.size();
+
+    gchar *size_str = purple_str_size_to_units(u->size);
+    report(u, std::string("Uploading (") + size_str + ")...");
+    g_free(size_str);
+
+    queue.push_back(u);
+
+    execute_next();
+}
+
+void UploadScheduler::execute_next() {
+    for (size_t i = 0; i < (size_t)MAX_CONNECTIONS && !queue.empty(); i++) {
+        if (i == connections.size()) {
+            Connection c;
+            c.http = boost::make_shared<LineHttpTransport>(
+                acct, conn, LINE_OS_SERVER, 443, false);
+            c.upload = nullptr;
+
+            // Failed connections are retried like failed uploads instead of disconnecting the
+            // account
+            c.http->set_error_callback([this, i]() {
+                complete(connections[i]);
+            });
+
+            connections.push_back(c);
+        }
+
+        if (connections[i].upload)
+            continue;
+
+        Upload *u = queue.front();
+        queue.pop_front();
+
+        u->attempts++;
+        u->start_time = g_get_monotonic_time();
+
+        connections[i].upload = u;
+
+        // Body parts are cheap to copy as large ones only refer to their data. The copy is kept
+        // for retries.
+        connections[i].http->request("POST", u->path, u->content_type, u->body, [this, i]() {
+            complete(connections[i]);
+        });
+    }
+
+    // The tick reports progress and requeues retries. It stops by itself once there's no work.
+    if (!tick_timeout)
+        tick_timeout = purple_timeout_add_seconds(1, WRAPPER(UploadScheduler::tick_cb), this);
+}
+
+void UploadScheduler::complete(Connection &c) {
+    Upload *u = c.upload;
+    c.upload = nullptr;
+
+    if (!u)
+        return;
+
+    gint64 now = g_get_monotonic_time();
+    int status = c.http->status_code();
+
+    if (status == 201) {
+        stat_completed++;
+        stat_bytes += u->size;
+        stat_transfer_time += now - u->start_time;
+        stat_latency += now - u->queue_time;
+
+        report(u, "Done.");
+
+        delete u;
+    } else if (u->attempts < MAX_ATTEMPTS) {
+        int delay = 1 << u->attempts;
+
+        purple_debug_warning("line", "Upload %d failed with status %d, retrying in %ds\n",
+            u->number, status, delay);
+
+        std::stringstream ss;
+        ss << "Failed, retrying in " << delay << " seconds...";
+        report(u, ss.str());
+
+        stat_retries++;
+
+        u->retry_time = now + delay * G_USEC_PER_SEC;
+        u->reported_percent = 0;
+        retry_queue.push_back(u);
+    } else {
+        purple_debug_warning("line", "Couldn't upload message media. Status: %d\n", status);
+
+        stat_failed++;
+
+        report(u, "Failed.");
+
+        delete u;
+    }
+
+    purple_debug_info("line", "Upload stats: %s\n", stats().c_str());
+
+    execute_next();
+}
+
+int UploadScheduler::tick_cb() {
+    gint64 now = g_get_monotonic_time();
+
+    // Report progress of running uploads in 25% steps
+
+    bool any_running = false;
+
+    for (Connection &c: connections) {
+        if (!c.upload)
+            continue;
+
+        any_running = true;
+
+        // Still connecting, the request hasn't been written yet
+        if (c.http->bytes_total() == 0)
+            continue;
+
+        int percent = (int)(100 * c.http->bytes_written() / c.http->bytes_total());
+        percent -= percent % 25;
+
+        if (percent > c.upload->reported_percent && percent < 100) {
+            c.upload->reported_percent = percent;
+
+            report(c.upload, std::to_string(percent) + "% done...");
+        }
+    }
+
+    // Requeue uploads whose retry delay has passed
+
+    for (auto i = retry_queue.begin(); i != retry_queue.end(); ) {
+        if ((*i)->retry_time <= now) {
+            queue.push_back(*i);
+            i = retry_queue.erase(i);
+        } else {
+            i++;
+        }
+    }
+
+    if (!any_running && queue.empty() && retry_queue.empty()) {
+        tick_timeout = 0;
+        return FALSE;
+    }
+
+    execute_next();
+
+    return TRUE;
+}
+
+void UploadScheduler::report(Upload *upload, std::string msg) {
+    PurpleConversation *conv = purple_find_conversation_with_account(
+        PURPLE_CONV_TYPE_ANY,
+        upload->conv_name.c_str(),
+        acct);
+
+    if (!conv)
+        return;
+
+    std::stringstream ss;
+    ss << "[Upload #" << upload->number << ", " << upload->description << "] " << msg;
+
+    purple_conversation_write(
+        conv,
+        "",
+        ss.str().c_str(),
+        (PurpleMessageFlags)PURPLE_MESSAGE_SYSTEM,
+        time(NULL));
+}
+
+std::string UploadScheduler::stats() {
+    std::stringstream ss;
+
+    ss
+        << "completed: " << stat_completed
+        << ", failed: " << stat_failed
+        << ", retries: " << stat_retries
+        << ", queued: " << (queue.size() + retry_queue.size());
+
+    if (stat_completed > 0) {
+        double seconds = (double)stat_transfer_time / G_USEC_PER_SEC;
+
+        ss
+            << std::fixed << std::setprecision(1)
+            << ", throughput: " << (seconds > 0 ? stat_bytes / 1024.0 / seconds : 0.0) << " KiB/s"
+            << ", average latency: "
+                << ((double)stat_latency / stat_completed / G_USEC_PER_SEC) << " s";
+    }
+
+    return ss.str();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <list>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+
+#include <account.h>
+#include <connection.h>
+
+#include "linehttptransport.hpp"
+
+// Uploads message media to the object storage server. Uploads run in parallel over a small pool of
+// connections, failed uploads are retried with a backoff and progress is reported in the
+// conversation the media was sent to.
+class UploadScheduler {
+
+    static const int MAX_CONNECTIONS = 3;
+    static const int MAX_ATTEMPTS = 4;
+
+    struct Upload {
+        int number;
+        std::string conv_name;
+        std::string description;
+        std::string path;
+        std::string content_type;
+        std::vector<LineHttpTransport::BodyPart> body;
+        size_t size;
+
+        int attempts;
+        int reported_percent;
+        gint64 queue_time;
+        gint64 start_time;
+        gint64 retry_time;
+    };
+
+    struct Connection {
+        boost::shared_ptr<LineHttpTransport> http;
+        Upload *upload;
+    };
+
+    PurpleAccount *acct;
+    PurpleConnection *conn;
+
+    std::vector<Connection> connections;
+    std::deque<Upload *> queue;
+    std::list<Upload *> retry_queue;
+
+    guint tick_timeout;
+    int next_number;
+
+    // Statistics
+    int stat_completed;
+    int stat_failed;
+    int stat_retries;
+    guint64 stat_bytes;
+    gint64 stat_transfer_time;
+    gint64 stat_latency;
+
+public:
+
+    UploadScheduler(PurpleAccount *acct, PurpleConnection *conn);
+    ~UploadScheduler();
+
+    void upload(std::string conv_name, std::string description,
+        std::string path, std::string content_type,
+        std::vector<LineHttpTransport::BodyPart> body);
+
+    std::string stats();
+
+private:
+
+    void execute_next();
+    void complete(Connection &c);
+    int tick_cb();
+
+    void report(Upload *upload, std::string msg);
+};
@@ -0,0 +1,60 @@
+#include "workerpool.hpp"
+
+WorkerPool::WorkerPool(int max_threads) {
+    pool = g_thread_pool_new(work_cb, (gpointer)this, max_threads, FALSE, nullptr);
+}
+
+WorkerPool::~WorkerPool() {
+    // Drops queued jobs and waits for running ones to finish
+    g_thread_pool_free(pool, TRUE, TRUE);
+
+    for (Job *job: jobs) {
+        if (job->finished)
+            g_source_remove(job->idle_handle);
+
+        delete job;
+    }
+}
+
+void WorkerPool::run(std::function<void()> work, std::function<void()> done) {
+    Job *job = new Job();
+    job->pool = this;
+    job->work = work;
+    job->done = done;
+    job->finished = false;
+    job->idle_handle = 0;
+
+    jobs.insert(job);
+
+    g_thread_pool_push(pool, (gpointer)job, nullptr);
+}
+
+void WorkerPool::work_cb(gpointer data, gpointer user_data) {
+    Job *job = (Job *)data;
+
+    job->work();
+
+    std::lock_guard<std::mutex> lock(job->pool->mutex);
+
+    job->finished = true;
+    job->idle_handle = g_idle_add(done_cb, (gpointer)job);
+}
+
+gboolean WorkerPool::done_cb(gpointer data) {
+    Job *job = (Job *)data;
+    WorkerPool *pool = job->pool;
+
+    {
+        // Make sure the worker is done with the job
+        std::lock_guard<std::mutex> lock(pool->mutex);
+    }
+
+    pool->jobs.erase(job);
+
+    job->done();
+
+    // The job, and whatever its functions hold on to, is released on the main loop
+    delete job;
+
+    return FALSE;
+}
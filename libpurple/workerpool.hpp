@@ -0,0 +1,39 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <set>
+
+#include <glib.h>
+
+// Runs jobs on a pool of worker threads. Work functions must not touch libpurple; their done
+// functions are run on the main loop afterwards. Jobs that haven't finished when the pool is
+// destroyed are dropped without calling their done functions.
+class WorkerPool {
+
+    struct Job {
+        WorkerPool *pool;
+        std::function<void()> work;
+        std::function<void()> done;
+        bool finished;
+        guint idle_handle;
+    };
+
+    GThreadPool *pool;
+
+    std::mutex mutex;
+    std::set<Job *> jobs;
+
+public:
+
+    WorkerPool(int max_threads);
+    ~WorkerPool();
+
+    void run(std::function<void()> work, std::function<void()> done);
+
+private:
+
+    static void work_cb(gpointer data, gpointer user_data);
+    static gboolean done_cb(gpointer data);
+
+};